@@ -7,8 +7,11 @@
 #include "feed.h"
 #include "gtkmodel.h"
 #include <gtk/gtk.h>
+#include <gdk/gdkkeysyms.h>
 #include <string.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <iterator>
 
 #ifdef USE_WEBKIT
 #include <webkit/webkit.h>
@@ -165,15 +168,34 @@ class FeedView : public TableModel
 public:
 	struct Listener {
 		virtual void newsSelected (News *news) = 0;
+		// asked for the next unread news of a feed that has none left that way
+		virtual void unreadRunOut (Feed *feed, bool backwards) = 0;
 	};
 	void setListener (Listener *listener)
 	{ this->listener = listener; }
 
+	enum Sort { FEED_ORDER, BY_DATE, BY_TITLE, BY_AUTHOR, UNREAD_FIRST, TOTAL_SORTS };
+
 private:
 	GtkWidget *widget, *view;
+	GtkTreeModel *model;
 	Listener *listener;
+	TableModel::Listener *model_listener;
 	Feed *feed;
+	Timeline *timeline;  // shown when there is no feed
+	const Folder *timeline_folder;  // whose it is; NULL for all feeds
+	std::vector <News *> results;  // shown when there is neither
+	// the rows as the view knows them, by feed and key: a refresh makes
+	// the news anew
+	typedef std::pair <const Feed *, guint64> RowKey;
+	std::vector <RowKey> shown;
 	bool unreadToggled;  // ignore selected signal on toggle
+	bool updating;  // nor when rows go from under the cursor
+	Sort sort;
+	bool unread_only;
+	std::string filter;  // case-folded
+	std::vector <News *> sorted;  // the rows, when sorted or filtered
+	TrigramIndex trigrams;  // of the source rows; made once a filter needs it
 
 	enum Columns { TITLE_COL, DATE_COL, WEIGHT_COL, WEIGHT_DATE_COL, UNREAD_COL,
 		TOOLTIP_COL, TOTAL_COLS };
@@ -182,9 +204,12 @@ public:
 	GtkWidget *getWidget() { return widget; }
 
 	FeedView()
-	: listener (NULL), feed (NULL), unreadToggled (false)
+	: listener (NULL), model_listener (NULL), feed (NULL), timeline (NULL), timeline_folder (NULL),
+	  unreadToggled (false),
+	  updating (false), sort (FEED_ORDER), unread_only (false)
 	{
 		view = gtk_tree_view_new();
+		model = gtk_my_model_new (this);
 		GtkCellRenderer *renderer;
 		renderer = appendCheckViewColumn (view, NULL, UNREAD_COL);
 		g_signal_connect (renderer, "toggled", G_CALLBACK (unread_toggled_cb), this);
@@ -193,6 +218,15 @@ public:
 //		appendTextViewColumn (view, "Author", AUTHOR_COL, false, WEIGHT_COL, -1, false, false);
 		appendTextViewColumn (view, "Date", DATE_COL, false, WEIGHT_DATE_COL, -1, false, false);
 		gtk_tree_view_set_tooltip_column (GTK_TREE_VIEW (view), TOOLTIP_COL);
+		static const Sort column_sorts[] = { UNREAD_FIRST, BY_TITLE, BY_DATE };
+		for (int i = 0; i < 3; i++) {
+			GtkTreeViewColumn *column = gtk_tree_view_get_column (GTK_TREE_VIEW (view), i);
+			gtk_tree_view_column_set_clickable (column, TRUE);
+			g_object_set_data (G_OBJECT (column), "sort", GINT_TO_POINTER (column_sorts[i]));
+			g_signal_connect (column, "clicked", G_CALLBACK (column_clicked_cb), this);
+		}
+		g_signal_connect (view, "button-press-event", G_CALLBACK (view_pressed_cb), this);
+		g_signal_connect (view, "key-press-event", G_CALLBACK (key_pressed_cb), this);
 
 		widget = create_scrolled_window (view);
 
@@ -202,25 +236,165 @@ public:
 		g_signal_connect (view, "row-activated", G_CALLBACK (news_double_clicked), this);
 	}
 
+	// the same feed again, once refreshed, only updates the rows
 	void setFeed (Feed *feed)
 	{
-		// destroy previous model before touching the feed pointer
+		trigrams.clear();
+		if (feed && feed == this->feed) {
+			update();
+			return;
+		}
 		gtk_tree_view_set_model (GTK_TREE_VIEW (view), NULL);
-
 		this->feed = feed;
-		if (feed) {
-			GtkTreeModel *model = gtk_my_model_new (this);
-			gtk_tree_view_set_model (GTK_TREE_VIEW (view), model);
-			g_object_unref (model);
-		}
+		delete timeline;
+		timeline = NULL;
+		results.clear();
+		shown.clear();
+		if (feed)
+			reset();
 		scrolledWindowScrollUp (widget);
 	}
 
+	// the unread news of the folder's feeds, or of all; made anew when
+	// called again
+	void setTimeline (const Folder *folder)
+	{
+		bool again = timeline != NULL && folder == timeline_folder;
+		feed = NULL;
+		results.clear();
+		trigrams.clear();
+		delete timeline;
+		timeline = new Timeline (Manager::get(), folder);
+		timeline_folder = folder;
+		reset();
+		if (!again)
+			scrolledWindowScrollUp (widget);
+	}
+
+	bool showsTimeline() const
+	{ return timeline != NULL; }
+	Feed *shownFeed() const
+	{ return feed; }
+	const Folder *timelineFolder() const
+	{ return timeline_folder; }
+
+	// a virtual feed of the news matching the query
+	void setSearch (const std::string &query)
+	{
+		bool searching = !feed && !timeline && !shown.empty();
+		if (!searching)
+			setFeed (NULL);
+		results.clear();
+		trigrams.clear();
+		Manager::get()->search (query, &results);
+		if (searching)
+			update();
+		else
+			reset();
+	}
+
+	// some of the feed's news were marked, maybe shown ones
+	void feedChanged (Feed *feed)
+	{
+		if (!this->feed || feed == this->feed) {
+			model_listener->rowsChanged();
+			gtk_widget_queue_draw (view);
+		}
+	}
+
+	// the feed is about to go, and its news with it
+	void dropFeed (Feed *feed)
+	{
+		if (feed == this->feed)
+			setFeed (NULL);
+		else if (timeline)  // it may have gone through its news
+			setTimeline (timeline_folder);
+		else if (!this->feed) {
+			std::vector <News *> rest;
+			for (unsigned int i = 0; i < results.size(); i++)
+				if (results[i]->from() != feed)
+					rest.push_back (results[i]);
+			results.swap (rest);
+			trigrams.clear();
+			update();
+		}
+	}
+
+	int resultsNb() const
+	{ return results.size(); }
+
+	// moves the cursor to the next unread row, or the previous one; from
+	// the start (or end) if restart. False if there is none that way.
+	bool selectUnread (bool backwards, bool restart = false)
+	{
+		int row = restart ? -1 : cursorRow();
+		if (feed && !arranged())  // rows are the feed's: as its index tells
+			row = feed->nextUnread (row, backwards);
+		else {  // those in between are looked at
+			int step = backwards ? -1 : 1, nb = rowsNb();
+			if (row < 0)
+				row = backwards ? nb : -1;
+			for (row += step; row >= 0 && row < nb; row += step) {
+				News *news = getNews (row);
+				if (!news || !news->isRead())
+					break;
+			}
+			if (row < 0 || row >= nb || !getNews (row))
+				row = -1;
+		}
+		if (row < 0)
+			return false;
+		GtkTreePath *path = gtk_tree_path_new_from_indices (row, -1);
+		gtk_tree_view_set_cursor (GTK_TREE_VIEW (view), path, NULL, FALSE);
+		gtk_tree_path_free (path);
+		return true;
+	}
+
+	News *getNews (int row) const
+	{ return arranged() ? sorted[row] : sourceNews (row); }
+
 	virtual int rowsNb() const
+	{ return arranged() ? sorted.size() : sourceNb(); }
+
+	// kept as the feeds change; clicking the column again undoes it
+	void setSort (Sort sort)
 	{
-		int rows;
-		for (rows = 0; feed->getNews (rows); rows++) ;
-		return rows;
+		this->sort = sort;
+		static const Sort column_sorts[] = { UNREAD_FIRST, BY_TITLE, BY_DATE };
+		for (int i = 0; i < 3; i++)
+			gtk_tree_view_column_set_sort_indicator (
+				gtk_tree_view_get_column (GTK_TREE_VIEW (view), i), sort == column_sorts[i]);
+		reset();
+	}
+
+	void setUnreadOnly (bool unread_only)
+	{
+		this->unread_only = unread_only;
+		reset();
+	}
+
+	// narrows the rows to the news whose title has the text, as it is typed
+	void setFilter (const std::string &text)
+	{
+		std::string key = filter_key (text.c_str());
+		if (key == filter)
+			return;
+		// typing on only drops rows; those left are matched again
+		bool narrower = !filter.empty() && key.find (filter) != std::string::npos;
+		filter = key;
+		if (narrower) {
+			std::vector <News *> left;
+			for (unsigned int i = 0; i < sorted.size(); i++)
+				if (filter_match (sorted[i]->titleKey().c_str(), filter))
+					left.push_back (sorted[i]);
+			sorted.swap (left);
+		}
+		else
+			arrange();
+		if (timeline && !arranged())
+			reload();
+		else
+			showRows();
 	}
 
 	virtual int columnsNb() const
@@ -245,19 +419,18 @@ public:
 
 	virtual void columnValue (int row, int col, GValue *value)
 	{
-		News *news = feed->getNews (row);
+		News *news = getNews (row);
 		g_value_init (value, columnType (col));
+		if (!news)  // a timeline short of what it counted
+			return;
 		switch ((Columns) col) {
-			case TITLE_COL: {
-				char *str = g_strdup (news->title().c_str());
-				g_value_set_string (value, str);
+			case TITLE_COL:
+				g_value_set_string (value, news->title().c_str());
 				break;
-			}
 			case DATE_COL: {
-				const char *str = news->date().c_str();
-				if (!*str)
-					str = news->updateDate().c_str();
-				g_value_set_string (value, g_strdup (str));
+				// formatted only now that the row is drawn
+				const Date &date = news->date().valid() ? news->date() : news->updateDate();
+				g_value_set_string (value, format_date (date).c_str());
 				break;
 			}
 			case UNREAD_COL:
@@ -271,20 +444,20 @@ public:
 				tooltip += title;
 				g_free (title);
 				tooltip += "\n";
-				if (!news->date().empty())
-					tooltip += "\n<b>Date: </b>" + news->date();
-				if (!news->updateDate().empty())
-					tooltip += "\n<b>Update: </b>" + news->updateDate();
+				if (news->date().valid())
+					tooltip += "\n<b>Date: </b>" + format_date (news->date());
+				if (news->updateDate().valid())
+					tooltip += "\n<b>Update: </b>" + format_date (news->updateDate());
 				if (!news->author().empty())
 					tooltip += "\n<b>Author: </b>" + news->author();
 				if (!news->categories().empty())
 					tooltip += "\n<b>Categories: </b>" + news->categories();
-				g_value_set_string (value, g_strdup (tooltip.c_str()));
+				g_value_set_string (value, tooltip.c_str());
 				break;
 			}
 			case WEIGHT_DATE_COL:
 #if 0
-				if (!news->updateDate().empty()) {
+				if (news->updateDate().valid()) {
 					g_value_set_int (value, PANGO_WEIGHT_BOLD);
 					break;
 				}
@@ -298,25 +471,197 @@ public:
 		}
 	}
 
-	virtual void moveRow (int row, int newRow) {}
-	virtual void setListener (TableModel::Listener *listener) {}
+	virtual void moveRow (int row, int parent, int index) {}
+	virtual void setListener (TableModel::Listener *listener)
+	{ model_listener = listener; }
 
 private:
+	News *sourceNews (int nb) const
+	{
+		if (feed)
+			return feed->getNews (nb);
+		return timeline ? timeline->getNews (nb) : results[nb];
+	}
+
+	int sourceNb() const
+	{
+		if (feed)
+			return feed->newsNb();
+		return timeline ? timeline->newsNb() : results.size();
+	}
+
+	bool arranged() const
+	{ return sort != FEED_ORDER || unread_only || !filter.empty(); }
+
+	bool shows (const News *news) const
+	{
+		return !(unread_only && news->isRead()) &&
+			filter_match (news->titleKey().c_str(), filter);
+	}
+
+	const TrigramIndex &sourceIndex()
+	{
+		if (trigrams.empty())
+			for (int i = 0; i < sourceNb(); i++) {
+				News *news = sourceNews (i);
+				if (!news)
+					break;
+				trigrams.add (i, news->titleKey().c_str());
+			}
+		return trigrams;
+	}
+
+	static gint64 news_time (const News *news)
+	{
+		const Date &date = news->date().valid() ? news->date() : news->updateDate();
+		return date.valid() ? date.time : G_MININT64;
+	}
+	static bool newer (const News *a, const News *b)
+	{ return news_time (a) > news_time (b); }
+	static bool title_before (const News *a, const News *b)
+	{ return g_ascii_strcasecmp (a->title().c_str(), b->title().c_str()) < 0; }
+	static bool author_before (const News *a, const News *b)
+	{ return a->author() < b->author(); }
+	static bool unread_before (const News *a, const News *b)
+	{ return !a->isRead() && b->isRead(); }
+
+	// works out the sorted rows from the source. Sorted by what doesn't
+	// change, those already there keep their order and the new ones are
+	// merged in, rather than sorting them all again.
+	void arrange()
+	{
+		if (!arranged()) {
+			sorted.clear();
+			return;
+		}
+		static bool (*const before[]) (const News *, const News *) =
+			{ NULL, newer, title_before, author_before, unread_before };
+		bool again = sort == FEED_ORDER || sort == UNREAD_FIRST || sorted.empty();
+		std::vector <News *> had, now, fresh;
+		if (!again) {
+			had = sorted;
+			std::sort (had.begin(), had.end());
+		}
+		// with many rows, only those the index tells may have the filter
+		std::vector <guint32> some;
+		bool indexed = filter.size() >= 3 && sourceNb() >= TRIGRAM_MIN_ROWS &&
+			sourceIndex().candidates (filter, &some);
+		int nb = indexed ? some.size() : sourceNb();
+		for (int i = 0; i < nb; i++) {
+			News *news = sourceNews (indexed ? some[i] : i);
+			if (!news)
+				break;
+			if (!shows (news))
+				continue;
+			if (!again)
+				now.push_back (news);
+			if (!std::binary_search (had.begin(), had.end(), news))
+				fresh.push_back (news);
+		}
+		if (sort != FEED_ORDER)
+			std::stable_sort (fresh.begin(), fresh.end(), before [sort]);
+		if (again)
+			sorted.swap (fresh);
+		else {
+			std::sort (now.begin(), now.end());
+			std::vector <News *> kept;
+			for (std::vector <News *>::iterator it = sorted.begin(); it != sorted.end(); it++)
+				if (std::binary_search (now.begin(), now.end(), *it))
+					kept.push_back (*it);
+			sorted.clear();
+			std::merge (kept.begin(), kept.end(), fresh.begin(), fresh.end(),
+				std::back_inserter (sorted), before [sort]);
+		}
+	}
+
+	// rebuilds the view, which is quicker when all rows change
+	void reset()
+	{
+		sorted.clear();
+		arrange();
+		reload();
+	}
+
+	void reload()
+	{
+		gtk_tree_view_set_model (GTK_TREE_VIEW (view), NULL);
+		model_listener->rowsChanged();
+		shown.clear();
+		if (!timeline || arranged())  // that one is only gone through as far as shown
+			for (int i = 0; i < rowsNb(); i++)
+				shown.push_back (rowKey (getNews (i)));
+		gtk_tree_view_set_model (GTK_TREE_VIEW (view), model);
+	}
+
+	void update()
+	{
+		arrange();
+		showRows();
+	}
+
+	// tells the view which rows went and came, so that it keeps its
+	// selection and scrolling, unless it had better be rebuilt
+	void showRows()
+	{
+		std::vector <RowKey> now (rowsNb());
+		for (unsigned int i = 0; i < now.size(); i++)
+			now[i] = rowKey (getNews (i));
+		updating = true;
+		bool updated = update_rows (model_listener, shown, now);
+		updating = false;
+		if (updated)
+			shown.swap (now);
+		else
+			reload();
+	}
+
+	static RowKey rowKey (News *news)
+	{ return RowKey (news->from(), news->keyHash()); }
+
 	static void news_selected (GtkTreeSelection *selection, FeedView *pThis)
 	{
-		if (pThis->unreadToggled)
+		if (pThis->unreadToggled || pThis->updating)
 			return;
 		GtkTreeModel *model;
 		GtkTreeIter iter;
 		if (gtk_tree_selection_get_selected (selection, &model, &iter)) {
 			int row = gtk_my_model_get_iter_row (&iter);
-			News *news = pThis->feed->getNews (row);
+			News *news = pThis->getNews (row);
+			if (!news)
+				return;
 			if (pThis->listener)
 				pThis->listener->newsSelected (news);
 			news->setRead (true);
 		}
 	}
 
+	int cursorRow()  // -1 if none
+	{
+		GtkTreePath *path;
+		gtk_tree_view_get_cursor (GTK_TREE_VIEW (view), &path, NULL);
+		if (!path)
+			return -1;
+		int row = gtk_tree_path_get_indices (path)[0];
+		gtk_tree_path_free (path);
+		return row;
+	}
+
+	// n and p go to the next and previous unread news, past this feed
+	static gboolean key_pressed_cb (GtkWidget *view, GdkEventKey *event, FeedView *pThis)
+	{
+		if (event->state & (GDK_CONTROL_MASK | GDK_MOD1_MASK))
+			return FALSE;
+		bool backwards;
+		switch (event->keyval) {
+			case GDK_n: backwards = false; break;
+			case GDK_p: backwards = true; break;
+			default: return FALSE;
+		}
+		if (!pThis->selectUnread (backwards) && pThis->listener)
+			pThis->listener->unreadRunOut (pThis->feed, backwards);
+		return TRUE;
+	}
+
 	static void news_double_clicked (GtkTreeView *view, GtkTreePath *path,
 	                                 GtkTreeViewColumn *column, FeedView *pThis)
 	{
@@ -324,11 +669,58 @@ private:
 		GtkTreeIter iter;
 		if (gtk_tree_model_get_iter (model, &iter, path)) {
 			int row = gtk_my_model_get_iter_row (&iter);
-			News *news = pThis->feed->getNews (row);
-			open_url (news->link());
+			News *news = pThis->getNews (row);
+			open_url (news->link().str());
 		}
 	}
 
+	static void column_clicked_cb (GtkTreeViewColumn *column, FeedView *pThis)
+	{
+		Sort sort = (Sort) GPOINTER_TO_INT (g_object_get_data (G_OBJECT (column), "sort"));
+		pThis->setSort (pThis->sort == sort ? FEED_ORDER : sort);
+	}
+
+	static void sort_toggled_cb (GtkCheckMenuItem *item, FeedView *pThis)
+	{
+		if (gtk_check_menu_item_get_active (item))
+			pThis->setSort ((Sort) GPOINTER_TO_INT (g_object_get_data (G_OBJECT (item), "sort")));
+	}
+
+	static void unread_only_toggled_cb (GtkCheckMenuItem *item, FeedView *pThis)
+	{
+		pThis->setUnreadOnly (gtk_check_menu_item_get_active (item));
+	}
+
+	static void menu_done_cb (GtkWidget *menu)
+	{ gtk_widget_destroy (menu); }
+
+	static gboolean view_pressed_cb (GtkWidget *view, GdkEventButton *event, FeedView *pThis)
+	{
+		if (event->button != 3)
+			return FALSE;
+		static const char *labels[] = { "Feed Order", "Newest First", "By Title",
+			"By Author", "Unread First" };
+		GtkWidget *menu = gtk_menu_new();
+		GSList *group = NULL;
+		for (int i = 0; i < TOTAL_SORTS; i++) {
+			GtkWidget *item = gtk_radio_menu_item_new_with_label (group, labels[i]);
+			group = gtk_radio_menu_item_get_group (GTK_RADIO_MENU_ITEM (item));
+			gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item), i == pThis->sort);
+			g_object_set_data (G_OBJECT (item), "sort", GINT_TO_POINTER (i));
+			g_signal_connect (item, "toggled", G_CALLBACK (sort_toggled_cb), pThis);
+			gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+		}
+		gtk_menu_shell_append (GTK_MENU_SHELL (menu), gtk_separator_menu_item_new());
+		GtkWidget *item = gtk_check_menu_item_new_with_label ("Unread Only");
+		gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item), pThis->unread_only);
+		g_signal_connect (item, "toggled", G_CALLBACK (unread_only_toggled_cb), pThis);
+		gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+		g_signal_connect (menu, "selection-done", G_CALLBACK (menu_done_cb), NULL);
+		gtk_widget_show_all (menu);
+		gtk_menu_popup (GTK_MENU (menu), NULL, NULL, NULL, NULL, 3, event->time);
+		return TRUE;
+	}
+
 	static gboolean unread_after_cb (gpointer pData)
 	{
 		FeedView *pThis = (FeedView *) pData;
@@ -342,7 +734,7 @@ private:
 		GtkTreeIter iter;
 		if (gtk_tree_model_get_iter_from_string (model, &iter, path_str)) {
 			int row = gtk_my_model_get_iter_row (&iter);
-			News *news = pThis->feed->getNews (row);
+			News *news = pThis->getNews (row);
 			news->setRead (!news->isRead());
 
 			g_idle_add (unread_after_cb, pThis);
@@ -360,23 +752,72 @@ class ManagerView : public Manager::Listener, TableModel
 public:
 	struct Listener {
 		virtual void feedSelected (Feed *feed) = 0;
+		virtual void timelineSelected (Folder *folder) = 0;  // NULL for all feeds
 	};
 	void setListener (Listener *listener)
 	{ this->listener = listener; }
 
 private:
 	GtkWidget *widget, *view;
+	GtkTreeModel *model;
 	Listener *listener;
 	TableModel::Listener *model_listener;
+	bool updating;  // rows go from under the cursor: not a selection
+	std::string filter;  // case-folded
+	std::vector <Feed *> matches;  // the rows, when filtering; NULL for the timeline
+	TrigramIndex trigrams;  // of the feeds; made once a filter needs it
+	// the row last selected, to be put back once rows are rebuilt
+	Feed *chosen_feed;
+	Folder *chosen_folder;
+	bool chosen_timeline;
+
+	// the rows are the timeline, the folders, and then the feeds in the
+	// manager's order, those of a folder under it. Filtering, the matching
+	// feeds follow the timeline, with no folders.
+	Feed *rowFeed (int row) const
+	{
+		if (!filter.empty())
+			return row < (signed) matches.size() ? matches[row] : NULL;
+		Manager *manager = Manager::get();
+		return manager->getFeed (row - 1 - manager->foldersNb());
+	}
+	Folder *rowFolder (int row) const
+	{
+		if (!filter.empty() || row < 1)
+			return NULL;
+		return Manager::get()->getFolder (row - 1);
+	}
+	// -1 if filtered out
+	int feedRow (Manager *manager, Feed *feed) const
+	{
+		if (filter.empty())
+			return manager->getFeedNb (feed) + 1 + manager->foldersNb();
+		std::vector <Feed *>::const_iterator it =
+			std::lower_bound (matches.begin() + 1, matches.end(), feed, feed_before);
+		return it != matches.end() && *it == feed ? it - matches.begin() : -1;
+	}
+	int folderRow (Manager *manager, Folder *folder) const
+	{ return filter.empty() ? manager->getFolderNb (folder) + 1 : -1; }
+	static bool feed_before (Feed *a, Feed *b)
+	{ return Manager::get()->getFeedNb (a) < Manager::get()->getFeedNb (b); }
+
+	enum Columns { TITLE_COL, TITLE_UNREAD_COL, WEIGHT_COL, COLOR_COL, ICON_COL,
+		TOOLTIP_COL, TOTAL_COLS };
 
-	enum Columns { TITLE_COL, TITLE_UNREAD_COL, WEIGHT_COL, COLOR_COL, ICON_COL, TOTAL_COLS };
+	// of feeds without an icon of their own, rendered once for the theme
+	enum IconState { DEFAULT_ICON, LOADING_ICON, ERROR_ICON, TIMELINE_ICON, FOLDER_ICON,
+		TOTAL_ICONS };
+	GdkPixbuf *state_icons [TOTAL_ICONS];
 
 public:
 	GtkWidget *getWidget() { return widget; }
 
 	ManagerView()
-	: listener (NULL), model_listener (NULL)
+	: listener (NULL), model_listener (NULL), updating (false), chosen_feed (NULL),
+	  chosen_folder (NULL), chosen_timeline (false)
 	{
+		for (int i = 0; i < TOTAL_ICONS; i++)
+			state_icons[i] = NULL;
 		view = gtk_tree_view_new();
 		gtk_tree_view_set_reorderable (GTK_TREE_VIEW (view), TRUE);
 
@@ -386,10 +827,14 @@ public:
 			TITLE_UNREAD_COL, false, WEIGHT_COL,
 			COLOR_COL, true, true);
 		gtk_tree_view_set_fixed_height_mode (GTK_TREE_VIEW (view), TRUE);
+		gtk_tree_view_set_tooltip_column (GTK_TREE_VIEW (view), TOOLTIP_COL);
 		g_object_set (renderer, "editable", TRUE, NULL);
-		g_signal_connect (renderer, "edited", G_CALLBACK (title_edited_cb), view);
+		g_signal_connect (renderer, "edited", G_CALLBACK (title_edited_cb), this);
 		g_signal_connect (view, "button-press-event", G_CALLBACK (view_pressed_cb), this);
 		g_signal_connect (view, "row-activated", G_CALLBACK (feed_double_clicked), this);
+		g_signal_connect (view, "style-set", G_CALLBACK (style_set_cb), this);
+		g_signal_connect (view, "row-expanded", G_CALLBACK (row_expanded_cb), this);
+		g_signal_connect (view, "row-collapsed", G_CALLBACK (row_collapsed_cb), this);
 
 		GtkTreeSelection *selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (view));
 		g_signal_connect (selection, "changed", G_CALLBACK (feed_selected_cb), this);
@@ -400,29 +845,102 @@ public:
 		Manager::get()->addListener (this);
 	}
 
-	Feed *getSelected()
+	int selectedRow()  // -1 if none
 	{
 		GtkTreeModel *model;
 		GtkTreeIter iter;
 		GtkTreeSelection *selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (view));
-		if (gtk_tree_selection_get_selected (selection, &model, &iter)) {
-			int row = gtk_my_model_get_iter_row (&iter);
-			return Manager::get()->getFeed (row);
-		}
-		return NULL;
+		if (gtk_tree_selection_get_selected (selection, &model, &iter))
+			return gtk_my_model_get_iter_row (&iter);
+		return -1;
 	}
 
+	Feed *getSelected()
+	{
+		int row = selectedRow();
+		return row >= 0 ? rowFeed (row) : NULL;
+	}
+
+	Folder *selectedFolder()
+	{ return rowFolder (selectedRow()); }
+
+	bool timelineSelected()
+	{ return selectedRow() == 0; }
+
 	void selectClear()
 	{
 		GtkTreeSelection *selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (view));
 		gtk_tree_selection_unselect_all (selection);
 	}
 
+	// false if filtered out
+	bool selectFeed (Feed *feed)
+	{
+		int row = feedRow (Manager::get(), feed);
+		if (row < 0)
+			return false;
+		GtkTreePath *path = gtk_my_model_get_row_path (model, row);
+		gtk_tree_view_expand_to_path (GTK_TREE_VIEW (view), path);
+		gtk_tree_view_set_cursor (GTK_TREE_VIEW (view), path, NULL, FALSE);
+		gtk_tree_path_free (path);
+		return true;
+	}
+
 	virtual int rowsNb() const
 	{
-		int rows;
-		for (rows = 0; Manager::get()->getFeed (rows); rows++) ;
-		return rows;
+		Manager *manager = Manager::get();
+		return filter.empty() ? 1 + manager->foldersNb() + manager->feedsNb() : matches.size();
+	}
+
+	virtual bool isTree() const
+	{ return true; }
+
+	virtual int parentRow (int row) const
+	{
+		Feed *feed = rowFeed (row);
+		return feed && feed->folder() ? folderRow (Manager::get(), feed->folder()) : -1;
+	}
+
+	virtual int childrenNb (int row) const
+	{
+		if (row >= 0) {
+			Folder *folder = rowFolder (row);
+			return folder ? folder->feedsNb() : 0;
+		}
+		if (!filter.empty())
+			return matches.size();
+		Manager *manager = Manager::get();
+		return 1 + manager->foldersNb() + manager->feedsNb() - manager->groupedNb();
+	}
+
+	virtual int childRow (int row, int nb) const
+	{
+		if (!filter.empty())
+			return nb;
+		Manager *manager = Manager::get();
+		int folders = manager->foldersNb();
+		if (row >= 0)
+			return 1 + folders + rowFolder (row)->firstFeedNb() + nb;
+		return nb <= folders ? nb : nb + manager->groupedNb();
+	}
+
+	virtual int rowIndex (int row) const
+	{
+		Feed *feed = rowFeed (row);
+		if (!filter.empty() || !feed)
+			return row;
+		Manager *manager = Manager::get();
+		if (feed->folder())
+			return manager->getFeedNb (feed) - feed->folder()->firstFeedNb();
+		return row - manager->groupedNb();
+	}
+
+	// narrows the feeds to those whose title has the text, as it is typed
+	void setFilter (const std::string &text)
+	{
+		std::string key = filter_key (text.c_str());
+		if (key != filter)  // typing on only drops rows
+			refilter (key, !filter.empty() && key.find (filter) != std::string::npos);
 	}
 
 	virtual int columnsNb() const
@@ -434,6 +952,7 @@ public:
 			case TITLE_COL:
 			case TITLE_UNREAD_COL:
 			case COLOR_COL:
+			case TOOLTIP_COL:
 				return G_TYPE_STRING;
 			case WEIGHT_COL:
 				return G_TYPE_INT;
@@ -446,12 +965,19 @@ public:
 
 	virtual void columnValue (int row, int col, GValue *value)
 	{
-		Feed *feed = Manager::get()->getFeed (row);
+		Feed *feed = rowFeed (row);
 		g_value_init (value, columnType (col));
+		if (!feed) {
+			Folder *folder = rowFolder (row);
+			if (folder)
+				folderValue (folder, col, value);
+			else
+				timelineValue (col, value);
+			return;
+		}
 		switch ((Columns) col) {
 			case TITLE_COL: {
-				const std::string &title = feed->title();
-				g_value_set_string (value, g_strdup (title.c_str()));
+				g_value_set_string (value, feed->title().c_str());
 				break;
 			}
 			case TITLE_UNREAD_COL: {
@@ -462,7 +988,7 @@ public:
 				char *str;
 				if (unread) str = g_strdup_printf ("%s (%d)", title.c_str(), unread);
 				else str = g_strdup (title.c_str());
-				g_value_set_string (value, str);
+				g_value_take_string (value, str);
 				break;
 			}
 			case WEIGHT_COL: {
@@ -480,36 +1006,107 @@ public:
 				break;
 			}
 			case ICON_COL: {
-				GdkPixbuf *pixbuf = 0;
-				const char *stock = GTK_STOCK_FILE; //DIRECTORY;
+				GdkPixbuf *pixbuf;
 				if (!feed->errorMsg().empty())
-					stock = GTK_STOCK_DIALOG_ERROR;
+					pixbuf = stateIcon (ERROR_ICON);
 				else if (feed->loading())
-					stock = GTK_STOCK_REFRESH;
-				else
+					pixbuf = stateIcon (LOADING_ICON);
+				else if (feed->iconPixbuf())
 					pixbuf = (GdkPixbuf *) feed->iconPixbuf();
-				if (!pixbuf) {
-					pixbuf = gtk_widget_render_icon (
-						widget, stock, GTK_ICON_SIZE_MENU, NULL);
-
-					if (feed->loading()) {
-						GdkPixbuf *old = pixbuf;
-						pixbuf = gdk_pixbuf_copy (old);
-						gdk_pixbuf_saturate_and_pixelate (old, pixbuf, 0.8, TRUE);
-						g_object_unref (old);
-					}
-				}
+				else
+					pixbuf = stateIcon (DEFAULT_ICON);
 				g_value_set_object (value, pixbuf);
 				break;
 			}
+			case TOOLTIP_COL: {
+				// only flag feeds in trouble; leave the others alone
+				if (!feed->errorMsg().empty()) {
+					gchar *error = g_markup_escape_text (feed->errorMsg().c_str(), -1);
+					gchar *str = g_strdup_printf ("<b>Error: </b>%s", error);
+					g_value_take_string (value, str);
+					g_free (error);
+				}
+				break;
+			}
+			case TOTAL_COLS: break;
+		}
+	}
+
+	virtual void moveRow (int row, int parent, int index)
+	{
+		Feed* feed = rowFeed (row);
+		if (!feed)  // the timeline and folders stay put
+			return;
+		Manager *manager = Manager::get();
+		if (!filter.empty()) {  // to where the feed of that row is
+			index = CLAMP (index, 1, (int) matches.size() - 1);
+			manager->move (feed, manager->getFeedNb (matches [index]));
+			return;
+		}
+		Feed *at = rowFeed (parent);
+		if (at) {  // dropped into a feed: next to it instead
+			parent = parentRow (parent);
+			index = rowIndex (manager->getFeedNb (at) + 1 + manager->foldersNb());
+		}
+		Folder *folder = rowFolder (parent);
+		manager->setFolder (feed, folder);
+		int pos;
+		if (folder)
+			pos = folder->firstFeedNb() + index;
+		else  // among those at the top, below the folders
+			pos = manager->groupedNb() + MAX (index - 1 - manager->foldersNb(), 0);
+		manager->move (feed, pos);
+	}
+
+	void timelineValue (int col, GValue *value)
+	{
+		int unread = Manager::get()->unreadNb();
+		switch ((Columns) col) {
+			case TITLE_COL:
+				g_value_set_static_string (value, "All unread");
+				break;
+			case TITLE_UNREAD_COL:
+				if (unread)
+					g_value_take_string (value, g_strdup_printf ("All unread (%d)", unread));
+				else
+					g_value_set_static_string (value, "All unread");
+				break;
+			case WEIGHT_COL:
+				g_value_set_int (value, unread ? PANGO_WEIGHT_BOLD : PANGO_WEIGHT_NORMAL);
+				break;
+			case ICON_COL:
+				g_value_set_object (value, stateIcon (TIMELINE_ICON));
+				break;
+			case COLOR_COL:
+			case TOOLTIP_COL:
 			case TOTAL_COLS: break;
 		}
 	}
 
-	virtual void moveRow (int row, int newRow)
+	void folderValue (Folder *folder, int col, GValue *value)
 	{
-		Feed* feed = Manager::get()->getFeed (row);
-		Manager::get()->move (feed, newRow);
+		int unread = folder->unreadNb();
+		switch ((Columns) col) {
+			case TITLE_COL:
+				g_value_set_string (value, folder->name().c_str());
+				break;
+			case TITLE_UNREAD_COL:
+				if (unread)
+					g_value_take_string (value, g_strdup_printf ("%s (%d)",
+						folder->name().c_str(), unread));
+				else
+					g_value_set_string (value, folder->name().c_str());
+				break;
+			case WEIGHT_COL:
+				g_value_set_int (value, unread ? PANGO_WEIGHT_BOLD : PANGO_WEIGHT_NORMAL);
+				break;
+			case ICON_COL:
+				g_value_set_object (value, stateIcon (FOLDER_ICON));
+				break;
+			case COLOR_COL:
+			case TOOLTIP_COL:
+			case TOTAL_COLS: break;
+		}
 	}
 
 	virtual void setListener (TableModel::Listener *listener)
@@ -517,33 +1114,266 @@ public:
 
 	void load()
 	{
-		GtkTreeModel *model = gtk_my_model_new (this);
+		model = gtk_my_model_new (this);
 		gtk_tree_view_set_model (GTK_TREE_VIEW (view), model);
-		g_object_unref (model);
+		expandFolders();
+	}
+
+	virtual void feedsChanged (Manager *manager, const std::vector <Feed *> &feeds)
+	{
+		trigrams.clear();  // their titles may be new
+		bool again = false;  // some came into the filter or left it
+		std::vector <Folder *> folders;  // their counts
+		for (std::vector <Feed *>::const_iterator it = feeds.begin(); it != feeds.end(); it++) {
+			int row = feedRow (manager, *it);
+			if ((row >= 0) != filter_match ((*it)->titleKey().c_str(), filter))
+				again = true;
+			else if (row >= 0)
+				model_listener->rowChanged (row);
+			if ((*it)->folder())
+				folders.push_back ((*it)->folder());
+		}
+		model_listener->rowChanged (0);  // its count
+		if (filter.empty()) {
+			std::sort (folders.begin(), folders.end());
+			folders.erase (std::unique (folders.begin(), folders.end()), folders.end());
+			for (unsigned int i = 0; i < folders.size(); i++)
+				model_listener->rowChanged (folderRow (manager, folders[i]));
+		}
+		if (again)
+			refilter (filter, false);
 	}
 
-	virtual void feedStatusChange (Manager *manager, Feed *feed)
+	virtual void feedsLoaded (Manager *manager, const std::vector <Feed *> &feeds) {}
+	virtual void feedsLoadingProgress (Manager *manager, float fraction) {}
+
+	virtual void feedAdded (Manager *manager, Feed *feed)
 	{
-		int row = manager->getFeedNb (feed);
-		model_listener->rowChanged (row);
+		trigrams.clear();
+		if (!filter.empty())
+			refilter (filter, false);
+		else
+			model_listener->rowInserted (feedRow (manager, feed));
 	}
 
-	virtual void feedLoading (Manager *manager, Feed *feed) {}
-	virtual void feedLoaded (Manager *manager, Feed *feed) {}
-	virtual void feedsLoadingProgress (Manager *manager, float fraction) {}
-
-	virtual void startStructuralChange (Manager *manager)
-	{ gtk_tree_view_set_model (GTK_TREE_VIEW (view), NULL); }
+	virtual void feedRemoved (Manager *manager, Feed *feed, int old_pos)
+	{
+		trigrams.clear();
+		if (feed == chosen_feed)
+			chosen_feed = NULL;
+		if (!filter.empty()) {
+			refilter (filter, false);
+			return;
+		}
+		// it is still in its folder, whose feeds start where they did
+		int row = old_pos + 1 + manager->foldersNb();
+		Folder *folder = feed->folder();
+		if (folder) {
+			int parent = folderRow (manager, folder);
+			model_listener->rowDeleted (row, parent, old_pos - folder->firstFeedNb());
+			if (!folder->feedsNb())
+				model_listener->rowHasChildToggled (parent);
+			model_listener->rowChanged (parent);  // its count
+		}
+		else
+			model_listener->rowDeleted (row, -1, row - manager->groupedNb());
+	}
 
-	virtual void endStructuralChange (Manager *manager)
-	{ load(); }
+	// among the feeds of its folder, or of the top
+	virtual void feedMoved (Manager *manager, Feed *feed, int old_pos)
+	{
+		trigrams.clear();
+		if (!filter.empty()) {
+			refilter (filter, false);
+			return;
+		}
+		Folder *folder = feed->folder();
+		int parent = folder ? folderRow (manager, folder) : -1;
+		int base = folder ? folder->firstFeedNb() : manager->groupedNb() - 1 - manager->foldersNb();
+		int pos = manager->getFeedNb (feed) - base, rows = childrenNb (parent);
+		old_pos -= base;
+		// the rows in between shift by one towards where it was
+		int *new_order = g_new (int, rows);
+		for (int i = 0; i < rows; i++)
+			new_order[i] = i;
+		for (int i = MIN (pos, old_pos); i <= MAX (pos, old_pos); i++)
+			new_order[i] = i + (pos > old_pos ? 1 : -1);
+		new_order[pos] = old_pos;
+		model_listener->rowsReordered (parent, new_order);
+		g_free (new_order);
+	}
+
+	virtual void foldersChanged (Manager *manager)
+	{
+		trigrams.clear();
+		if (chosen_folder && manager->getFolderNb (chosen_folder) < 0)
+			chosen_folder = NULL;  // it's gone
+		if (!filter.empty())
+			refilter (filter, false);
+		else
+			reload();
+	}
 
 private:
+	// the feeds the view shows, as rows
+	void shownFeeds (std::vector <Feed *> *feeds) const
+	{
+		if (!filter.empty()) {
+			*feeds = matches;
+			return;
+		}
+		Manager *manager = Manager::get();
+		feeds->assign (1, (Feed *) NULL);
+		for (int i = 0; i < manager->feedsNb(); i++)
+			feeds->push_back (manager->getFeed (i));
+	}
+
+	const TrigramIndex &feedsIndex()
+	{
+		Manager *manager = Manager::get();
+		if (trigrams.empty())
+			for (int i = 0; i < manager->feedsNb(); i++)
+				trigrams.add (i, manager->getFeed (i)->titleKey().c_str());
+		return trigrams;
+	}
+
+	// works out the matching feeds anew, or only out of those matching
+	// already, and tells the view which rows went and came
+	void refilter (const std::string &key, bool narrower)
+	{
+		std::vector <Feed *> old, now;
+		if (!filter.empty() && !key.empty())  // else the folders are there: rebuilt
+			shownFeeds (&old);
+		filter = key;
+		if (filter.empty())
+			matches.clear();
+		else if (narrower) {
+			std::vector <Feed *> left (1, (Feed *) NULL);
+			for (unsigned int i = 1; i < matches.size(); i++)
+				if (filter_match (matches[i]->titleKey().c_str(), filter))
+					left.push_back (matches[i]);
+			matches.swap (left);
+		}
+		else {
+			// with many feeds, only those the index tells may have it
+			Manager *manager = Manager::get();
+			std::vector <guint32> some;
+			bool indexed = filter.size() >= 3 && manager->feedsNb() >= TRIGRAM_MIN_ROWS &&
+				feedsIndex().candidates (filter, &some);
+			int nb = indexed ? some.size() : manager->feedsNb();
+			matches.assign (1, (Feed *) NULL);
+			for (int i = 0; i < nb; i++) {
+				Feed *feed = manager->getFeed (indexed ? some[i] : i);
+				if (filter_match (feed->titleKey().c_str(), filter))
+					matches.push_back (feed);
+			}
+		}
+
+		shownFeeds (&now);
+		updating = true;
+		bool updated = !old.empty() && update_rows (model_listener, old, now);
+		updating = false;
+		if (!updated)
+			reload();
+	}
+
+	// rebuilds the view, with the folders expanded as they were and the
+	// selection put back
+	void reload()
+	{
+		updating = true;
+		gtk_tree_view_set_model (GTK_TREE_VIEW (view), NULL);
+		model_listener->rowsChanged();
+		gtk_tree_view_set_model (GTK_TREE_VIEW (view), model);
+		expandFolders();
+		Manager *manager = Manager::get();
+		int row = -1;
+		if (chosen_timeline)
+			row = 0;
+		else if (chosen_folder)
+			row = folderRow (manager, chosen_folder);
+		else if (chosen_feed)
+			row = feedRow (manager, chosen_feed);
+		if (row >= 0) {
+			GtkTreePath *path = gtk_my_model_get_row_path (model, row);
+			gtk_tree_view_expand_to_path (GTK_TREE_VIEW (view), path);
+			gtk_tree_selection_select_path (
+				gtk_tree_view_get_selection (GTK_TREE_VIEW (view)), path);
+			gtk_tree_path_free (path);
+		}
+		updating = false;
+	}
+
+	void expandFolders()
+	{
+		Manager *manager = Manager::get();
+		if (filter.empty())
+			for (int i = 0; i < manager->foldersNb(); i++)
+				if (manager->getFolder (i)->expanded()) {
+					GtkTreePath *path = gtk_tree_path_new_from_indices (i + 1, -1);
+					gtk_tree_view_expand_row (GTK_TREE_VIEW (view), path, FALSE);
+					gtk_tree_path_free (path);
+				}
+	}
+
+	GdkPixbuf *stateIcon (IconState state)
+	{
+		if (!state_icons [state]) {
+			static const char *stocks[] = { GTK_STOCK_FILE, GTK_STOCK_REFRESH,
+				GTK_STOCK_DIALOG_ERROR, GTK_STOCK_INDEX, GTK_STOCK_DIRECTORY };
+			GdkPixbuf *pixbuf = gtk_widget_render_icon (
+				widget, stocks [state], GTK_ICON_SIZE_MENU, NULL);
+			if (state == LOADING_ICON) {  // greyed
+				GdkPixbuf *old = pixbuf;
+				pixbuf = gdk_pixbuf_copy (old);
+				gdk_pixbuf_saturate_and_pixelate (old, pixbuf, 0.8, TRUE);
+				g_object_unref (old);
+			}
+			state_icons [state] = pixbuf;
+		}
+		return state_icons [state];
+	}
+
+	// a new theme: render them anew
+	static void style_set_cb (GtkWidget *view, GtkStyle *previous, ManagerView *pThis)
+	{
+		for (int i = 0; i < TOTAL_ICONS; i++)
+			if (pThis->state_icons[i]) {
+				g_object_unref (pThis->state_icons[i]);
+				pThis->state_icons[i] = NULL;
+			}
+		if (pThis->model_listener)
+			pThis->model_listener->rowsChanged();
+	}
+
 	static void feed_selected_cb (GtkTreeSelection *selection, ManagerView *pThis)
 	{
-		if (pThis->listener)
-			pThis->listener->feedSelected (pThis->getSelected());
+		if (pThis->updating)
+			return;
+		int row = pThis->selectedRow();
+		pThis->chosen_timeline = row == 0;
+		pThis->chosen_folder = pThis->rowFolder (row);
+		pThis->chosen_feed = row >= 0 ? pThis->rowFeed (row) : NULL;
+		if (!pThis->listener)
+			return;
+		if (pThis->chosen_timeline || pThis->chosen_folder)
+			pThis->listener->timelineSelected (pThis->chosen_folder);
+		else
+			pThis->listener->feedSelected (pThis->chosen_feed);
+	}
+
+	static void folder_toggled (GtkTreeIter *iter, ManagerView *pThis, bool expanded)
+	{
+		Folder *folder = pThis->rowFolder (gtk_my_model_get_iter_row (iter));
+		if (folder)
+			folder->setExpanded (expanded);
 	}
+	static void row_expanded_cb (GtkTreeView *view, GtkTreeIter *iter, GtkTreePath *path,
+	                             ManagerView *pThis)
+	{ folder_toggled (iter, pThis, true); }
+	static void row_collapsed_cb (GtkTreeView *view, GtkTreeIter *iter, GtkTreePath *path,
+	                              ManagerView *pThis)
+	{ folder_toggled (iter, pThis, false); }
 
 	static void feed_double_clicked (GtkTreeView *view, GtkTreePath *path,
 	                                 GtkTreeViewColumn *column, ManagerView *pThis)
@@ -551,9 +1381,9 @@ private:
 		GtkTreeModel *model = gtk_tree_view_get_model (view);
 		GtkTreeIter iter;
 		if (gtk_tree_model_get_iter (model, &iter, path)) {
-			int row = gtk_my_model_get_iter_row (&iter);
-			Feed *feed = Manager::get()->getFeed (row);
-			open_url (feed->link());
+			Feed *feed = pThis->rowFeed (gtk_my_model_get_iter_row (&iter));
+			if (feed)
+				open_url (feed->link());
 		}
 	}
 
@@ -564,7 +1394,8 @@ private:
 		GtkTreeSelection *selection = gtk_tree_view_get_selection (view);
 		GtkTreeIter iter;
 		GtkTreeModel *model;
-		if (gtk_tree_selection_get_selected (selection, &model, &iter)) {
+		if (gtk_tree_selection_get_selected (selection, &model, &iter) &&
+		    gtk_my_model_get_iter_row (&iter) > 0) {
 			GtkTreePath *path = gtk_tree_model_get_path (model, &iter);
 			gtk_tree_view_set_cursor (view, path, column, TRUE);
 			gtk_tree_path_free (path);
@@ -573,22 +1404,145 @@ private:
 
 	static void remove_activate_cb (GtkWidget *widget, ManagerView *pThis)
 	{
-		Manager::get()->removeFeed (pThis->getSelected());
+		Feed *feed = pThis->getSelected();
+		Folder *folder = pThis->selectedFolder();
+		if (feed)
+			Manager::get()->removeFeed (feed);
+		else if (folder)
+			Manager::get()->removeFolder (folder);
+	}
+
+	static void new_folder_activate_cb (GtkWidget *widget, ManagerView *pThis)
+	{
+		Manager *manager = Manager::get();
+		std::string name ("New Folder");
+		for (int i = 2; manager->findFolder (name); i++) {
+			gchar *str = g_strdup_printf ("New Folder %d", i);
+			name = str;
+			g_free (str);
+		}
+		Folder *folder = manager->addFolder (name);
+		int row = pThis->folderRow (manager, folder);
+		if (row < 0)  // filtering
+			return;
+		GtkTreePath *path = gtk_my_model_get_row_path (pThis->model, row);
+		gtk_tree_view_set_cursor (GTK_TREE_VIEW (pThis->view), path,
+			gtk_tree_view_get_column (GTK_TREE_VIEW (pThis->view), 1), TRUE);
+		gtk_tree_path_free (path);
+	}
+
+	static void move_to_activate_cb (GtkWidget *widget, ManagerView *pThis)
+	{
+		Feed *feed = pThis->getSelected();
+		if (feed)
+			Manager::get()->setFolder (feed,
+				(Folder *) g_object_get_data (G_OBJECT (widget), "folder"));
+	}
+
+	static void refresh_toggled_cb (GtkCheckMenuItem *item, ManagerView *pThis)
+	{
+		Folder *folder = pThis->selectedFolder();
+		if (folder && gtk_check_menu_item_get_active (item))
+			Manager::get()->setRefreshInterval (folder,
+				GPOINTER_TO_INT (g_object_get_data (G_OBJECT (item), "minutes")));
+	}
+
+	// of the selected feed, folder, or of all for the timeline
+	void markRead (gint64 before)
+	{
+		Feed *feed = getSelected();
+		if (feed)
+			feed->markAllRead (before);
+		else
+			Manager::get()->markAllRead (selectedFolder(), before);
+	}
+	static void mark_read_activate_cb (GtkWidget *widget, ManagerView *pThis)
+	{ pThis->markRead (0); }
+	static void mark_old_read_activate_cb (GtkWidget *widget, ManagerView *pThis)
+	{ pThis->markRead (time (NULL) - 7 * 86400); }
+
+	static void menu_done_cb (GtkWidget *menu)
+	{ gtk_widget_destroy (menu); }
+
+	// made anew each time, after the folders there are
+	GtkWidget *createPopup (Feed *feed, Folder *folder)
+	{
+		GtkWidget *menu = gtk_menu_new();
+		appendMenuItem (GTK_MENU (menu), "Mark All Read", GTK_STOCK_APPLY,
+			G_CALLBACK (mark_read_activate_cb), this);
+		appendMenuItem (GTK_MENU (menu), "Mark Week-Old Read", NULL,
+			G_CALLBACK (mark_old_read_activate_cb), this);
+		gtk_menu_shell_append (GTK_MENU_SHELL (menu), gtk_separator_menu_item_new());
+		if (feed || folder) {
+			appendMenuItem (GTK_MENU (menu), "Rename", GTK_STOCK_EDIT,
+				G_CALLBACK (edit_activate_cb), this);
+			appendMenuItem (GTK_MENU (menu), GTK_STOCK_REMOVE,
+				G_CALLBACK (remove_activate_cb), this);
+			gtk_menu_shell_append (GTK_MENU_SHELL (menu), gtk_separator_menu_item_new());
+		}
+
+		Manager *manager = Manager::get();
+		if (feed) {
+			GtkWidget *submenu = gtk_menu_new();
+			for (int i = 0; i <= manager->foldersNb(); i++) {
+				Folder *to = i < manager->foldersNb() ? manager->getFolder (i) : NULL;
+				if (!to)
+					gtk_menu_shell_append (GTK_MENU_SHELL (submenu),
+						gtk_separator_menu_item_new());
+				GtkWidget *item = gtk_menu_item_new_with_label (
+					to ? to->name().c_str() : "None");
+				gtk_widget_set_sensitive (item, to != feed->folder());
+				g_object_set_data (G_OBJECT (item), "folder", to);
+				g_signal_connect (item, "activate", G_CALLBACK (move_to_activate_cb), this);
+				gtk_menu_shell_append (GTK_MENU_SHELL (submenu), item);
+			}
+			GtkWidget *item = gtk_menu_item_new_with_label ("Move to");
+			gtk_menu_item_set_submenu (GTK_MENU_ITEM (item), submenu);
+			gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+		}
+		else if (folder) {
+			static const char *labels[] = { "Default", "Every 15 Minutes", "Every Hour",
+				"Every 4 Hours", "Manually" };
+			static const int minutes[] = { -1, 15, 60, 240, 0 };
+			GtkWidget *submenu = gtk_menu_new();
+			GSList *group = NULL;
+			for (int i = 0; i < 5; i++) {
+				GtkWidget *item = gtk_radio_menu_item_new_with_label (group, labels[i]);
+				group = gtk_radio_menu_item_get_group (GTK_RADIO_MENU_ITEM (item));
+				gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item),
+					minutes[i] == folder->refreshInterval());
+				g_object_set_data (G_OBJECT (item), "minutes", GINT_TO_POINTER (minutes[i]));
+				g_signal_connect (item, "toggled", G_CALLBACK (refresh_toggled_cb), this);
+				gtk_menu_shell_append (GTK_MENU_SHELL (submenu), item);
+			}
+			GtkWidget *item = gtk_menu_item_new_with_label ("Refresh");
+			gtk_menu_item_set_submenu (GTK_MENU_ITEM (item), submenu);
+			gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+		}
+		appendMenuItem (GTK_MENU (menu), "New Folder", GTK_STOCK_DIRECTORY,
+			G_CALLBACK (new_folder_activate_cb), this);
+		g_signal_connect (menu, "selection-done", G_CALLBACK (menu_done_cb), NULL);
+		gtk_widget_show_all (menu);
+		return menu;
 	}
 
 	static void title_edited_cb (GtkCellRendererText *renderer, gchar *path,
-	                             gchar *text, GtkTreeView *view)
+	                             gchar *text, ManagerView *pThis)
 	{
-		GtkTreeModel *model = gtk_tree_view_get_model (view);
+		GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW (pThis->view));
 		GtkTreeIter iter;
 		gtk_tree_model_get_iter_from_string (model, &iter, path);
 
 		gchar *old_text;
 		gtk_tree_model_get (model, &iter, TITLE_UNREAD_COL, &old_text, -1);
+		int row = gtk_my_model_get_iter_row (&iter);
+		Feed *feed = pThis->rowFeed (row);
+		Folder *folder = pThis->rowFolder (row);
 		if (strcmp (old_text, text) != 0) {
-			int row = gtk_my_model_get_iter_row (&iter);
-			Feed *feed = Manager::get()->getFeed (row);
-			feed->setUserTitle (text);
+			if (feed)
+				feed->setUserTitle (text);
+			else if (folder && !Manager::get()->renameFolder (folder, text))
+				gdk_beep();  // taken
 		}
 		g_free (old_text);
 	}
@@ -604,15 +1558,8 @@ private:
 				event->button = 1;
 				gtk_widget_event (view, (GdkEvent *) event);
 
-				static GtkWidget *menu = 0;
-				if (!menu) {
-					menu = gtk_menu_new();
-					appendMenuItem (GTK_MENU (menu), "Rename", GTK_STOCK_EDIT,
-						G_CALLBACK (edit_activate_cb), pThis);
-					appendMenuItem (GTK_MENU (menu), GTK_STOCK_REMOVE,
-						G_CALLBACK (remove_activate_cb), pThis);
-					gtk_widget_show_all (menu);
-				}
+				GtkWidget *menu = pThis->createPopup (pThis->getSelected(),
+					pThis->selectedFolder());
 				gtk_menu_popup (GTK_MENU (menu), NULL, NULL, NULL, NULL, 3, event->time);
 			}
 			return TRUE;
@@ -1018,26 +1965,35 @@ class App : public FeedView::Listener, ManagerView::Listener, HtmlView::Listener
 	ManagerView *feeds;
 	GtkWidget *statusbar, *progressbar, *refresh_button, *refresh_item;
 	Window *window;
+	std::string query;  // searching, if not empty
 
 	virtual void newsSelected (News *news)
 	{
 		std::string text;
-		const std::string &title = news->title();
+		const Text &title = news->title();
 		const std::string &author = news->author();
-		const std::string &summary = news->summary();
+		const Text &summary = news->summary();
 		text.reserve (title.size() + author.size() + summary.size() + 200);
-		text += "<p><b>" + title + "</b>";
-		if (!author.empty())
-			text += "<br /><small>by " + author + "</small>";
+		text += "<p><b>";
+		text += title.c_str();
+		text += "</b>";
+		if (!author.empty()) {
+			text += "<br /><small>by ";
+			text += author.c_str();
+			text += "</small>";
+		}
 		text += "</p>\n";
-		text += summary;
-		text += "\n<p><a href=\"" + news->link() + "\">more</a></p>";
+		text.append (summary.c_str(), summary.size());
+		text += "\n<p><a href=\"";
+		text += news->link().c_str();
+		text += "\">more</a></p>";
 		html->setText (text, news->from()->link());
 	}
 
 	virtual void feedSelected (Feed *feed)
 	{
 		news->setFeed (feed);
+		query.clear();
 		if (feed) {
 			window->setTitle (feed->title());
 
@@ -1065,6 +2021,25 @@ class App : public FeedView::Listener, ManagerView::Listener, HtmlView::Listener
 		}
 	}
 
+	// on to the feeds after it, in the feeds list order
+	virtual void unreadRunOut (Feed *feed, bool backwards)
+	{
+		Manager *manager = Manager::get();
+		Feed *next = feed ? manager->nextUnreadFeed (manager->getFeedNb (feed), backwards) : NULL;
+		if (next && next != feed && !feeds->selectFeed (next))
+			next = NULL;
+		if (!next || !news->selectUnread (backwards, true))
+			gdk_beep();
+	}
+
+	virtual void timelineSelected (Folder *folder)
+	{
+		news->setTimeline (folder);
+		query.clear();
+		window->setTitle (folder ? folder->name() : "All unread");
+		html->setText ("");
+	}
+
 	virtual void over_url (const char *url)
 	{
 		GtkStatusbar *s = GTK_STATUSBAR (statusbar);
@@ -1083,8 +2058,10 @@ class App : public FeedView::Listener, ManagerView::Listener, HtmlView::Listener
 		return FALSE;
 	}
 
-	virtual void feedStatusChange (Manager *manager, Feed *feed)
+	virtual void feedsChanged (Manager *manager, const std::vector <Feed *> &changed)
 	{
+		for (std::vector <Feed *>::const_iterator it = changed.begin(); it != changed.end(); it++)
+			news->feedChanged (*it);
 		int unread = manager->unreadNb();
 		if (unread) {
 			gchar *tooltip = g_strdup_printf ("%d fresh news", unread);
@@ -1098,22 +2075,27 @@ class App : public FeedView::Listener, ManagerView::Listener, HtmlView::Listener
 		}
 	}
 
-	// recreate FeedView model when loading news
-	virtual void feedLoading (Manager *manager, Feed *feed)
+	// news stay put while loading; FeedView rows are updated once merged
+	virtual void feedsLoaded (Manager *manager, const std::vector <Feed *> &loaded)
 	{
-		if (feeds->getSelected() == feed)
-			news->setFeed (NULL);
-	}
-	virtual void feedLoaded (Manager *manager, Feed *feed)
-	{
-		if (feeds->getSelected() == feed)
-			news->setFeed (feed);
+		Feed *selected = feeds->getSelected();
+		if (selected && std::find (loaded.begin(), loaded.end(), selected) != loaded.end())
+			news->setFeed (selected);
+		else if (news->showsTimeline())
+			news->setTimeline (news->timelineFolder());
+		else if (!query.empty())  // the results may be gone
+			news->setSearch (query);
 
 		GtkStatusbar *s = GTK_STATUSBAR (statusbar);
 		guint id = gtk_statusbar_get_context_id (s, "loaded");
-		std::string str = feed->title() + " loaded";
+		gchar *str;
+		if (loaded.size() == 1)
+			str = g_strdup_printf ("%s loaded", loaded[0]->title().c_str());
+		else
+			str = g_strdup_printf ("%d feeds loaded", (int) loaded.size());
 		gtk_statusbar_pop (s, id);
-		gtk_statusbar_push (s, id, str.c_str());
+		gtk_statusbar_push (s, id, str);
+		g_free (str);
 	}
 
 	virtual void feedsLoadingProgress (Manager *manager, float fraction)
@@ -1141,12 +2123,28 @@ class App : public FeedView::Listener, ManagerView::Listener, HtmlView::Listener
 		}
 	}
 
-	virtual void startStructuralChange (Manager *manager)
+	virtual void feedAdded (Manager *manager, Feed *feed) {}
+	virtual void feedMoved (Manager *manager, Feed *feed, int old_pos) {}
+
+	virtual void feedRemoved (Manager *manager, Feed *feed, int old_pos)
 	{
-		news->setFeed (NULL);
+		news->dropFeed (feed);
 	}
 
-	virtual void endStructuralChange (Manager *manager) {}
+	// a folder's timeline has other feeds now, or none
+	virtual void foldersChanged (Manager *manager)
+	{
+		if (!news->showsTimeline())
+			return;
+		Folder *folder = (Folder *) news->timelineFolder();
+		if (folder && manager->getFolderNb (folder) < 0) {
+			folder = NULL;
+			window->setTitle ("All unread");
+		}
+		else if (folder)
+			window->setTitle (folder->name());
+		news->setTimeline (folder);
+	}
 
 	virtual void windowShow() {}
 
@@ -1172,8 +2170,15 @@ public:
 		gtk_paned_pack2 (GTK_PANED (vpaned), html->getWidget(), TRUE, FALSE);
 		gtk_paned_set_position (GTK_PANED (vpaned), 120);
 
+		GtkWidget *filter_entry = gtk_entry_new();
+		gtk_widget_set_tooltip_text (filter_entry, "Filter feeds and news by title");
+		g_signal_connect (filter_entry, "changed", G_CALLBACK (filter_changed_cb), this);
+		GtkWidget *feeds_box = gtk_vbox_new (FALSE, 0);
+		gtk_box_pack_start (GTK_BOX (feeds_box), filter_entry, FALSE, TRUE, 0);
+		gtk_box_pack_start (GTK_BOX (feeds_box), feeds->getWidget(), TRUE, TRUE, 0);
+
 		GtkWidget *hpaned = gtk_hpaned_new();
-		gtk_paned_pack1 (GTK_PANED (hpaned), feeds->getWidget(), FALSE, FALSE);
+		gtk_paned_pack1 (GTK_PANED (hpaned), feeds_box, FALSE, FALSE);
 		gtk_paned_pack2 (GTK_PANED (hpaned), vpaned, TRUE, FALSE);
 		gtk_paned_set_position (GTK_PANED (hpaned), 160);
 
@@ -1183,6 +2188,17 @@ public:
 		gtk_toolbar_insert (GTK_TOOLBAR (toolbar), gtk_separator_tool_item_new(), -1);
 		appendToolbar (toolbar, GTK_STOCK_ABOUT, NULL, false, G_CALLBACK (about_clicked_cb));
 		appendToolbar (toolbar, GTK_STOCK_QUIT, NULL, false, G_CALLBACK (gtk_main_quit));
+		GtkToolItem *space = gtk_separator_tool_item_new();
+		gtk_separator_tool_item_set_draw (GTK_SEPARATOR_TOOL_ITEM (space), FALSE);
+		gtk_tool_item_set_expand (space, TRUE);
+		gtk_toolbar_insert (GTK_TOOLBAR (toolbar), space, -1);
+		GtkWidget *search_entry = gtk_entry_new();
+		gtk_widget_set_tooltip_text (search_entry,
+			"Search all news, or by author:, category: or site: name");
+		g_signal_connect (search_entry, "activate", G_CALLBACK (search_activate_cb), this);
+		GtkToolItem *search_item = gtk_tool_item_new();
+		gtk_container_add (GTK_CONTAINER (search_item), search_entry);
+		gtk_toolbar_insert (GTK_TOOLBAR (toolbar), search_item, -1);
 
 		statusbar = gtk_statusbar_new();
 		progressbar = gtk_progress_bar_new();
@@ -1320,6 +2336,30 @@ private:
 		Manager::get()->refreshAll();
 	}
 
+	static void search_activate_cb (GtkEntry *entry, App *pThis)
+	{
+		pThis->feeds->selectClear();
+		pThis->query = gtk_entry_get_text (entry);
+		GtkStatusbar *s = GTK_STATUSBAR (pThis->statusbar);
+		guint id = gtk_statusbar_get_context_id (s, "search");
+		gtk_statusbar_pop (s, id);
+		if (pThis->query.empty())
+			return;
+
+		pThis->news->setSearch (pThis->query);
+		pThis->window->setTitle ("Search: " + pThis->query);
+		gchar *str = g_strdup_printf ("%d news found", pThis->news->resultsNb());
+		gtk_statusbar_push (s, id, str);
+		g_free (str);
+	}
+
+	static void filter_changed_cb (GtkEditable *editable, App *pThis)
+	{
+		const gchar *text = gtk_entry_get_text (GTK_ENTRY (editable));
+		pThis->feeds->setFilter (text);
+		pThis->news->setFilter (text);
+	}
+
 	static void about_dialog_activate_link_cb (
 		GtkAboutDialog *about, const gchar *link, gpointer data)
 	{ open_url (link); }
@@ -0,0 +1,65 @@
+// arena.cpp
+
+#include "arena.h"
+#include <string.h>
+
+#define BLOCK_SIZE (64*1024)
+#define HEADER ((sizeof (Block) + 7) & ~(size_t) 7)
+
+Arena::Arena()
+: blocks (NULL), p (NULL), end (NULL), refs (1)
+{}
+
+Arena::~Arena()
+{
+	while (blocks) {
+		Block *next = blocks->next;
+		g_free (blocks);
+		blocks = next;
+	}
+}
+
+void Arena::ref()
+{ g_atomic_int_inc (&refs); }
+
+void Arena::unref()
+{
+	if (g_atomic_int_dec_and_test (&refs))
+		delete this;
+}
+
+void *Arena::alloc (size_t size)
+{
+	size = (size + 7) & ~(size_t) 7;
+	if ((size_t) (end - p) < size) {
+		// big ones get a block of their own, so the current one goes on
+		size_t block_size = size > BLOCK_SIZE / 4 ? size : BLOCK_SIZE;
+		Block *block = (Block *) g_malloc (HEADER + block_size);
+		char *data = (char *) block + HEADER;
+		if (block_size == size && blocks) {
+			block->next = blocks->next;
+			blocks->next = block;
+			return data;
+		}
+		block->next = blocks;
+		blocks = block;
+		p = data;
+		end = data + block_size;
+	}
+	void *ret = p;
+	p += size;
+	return ret;
+}
+
+Text Arena::copy (const char *str, size_t len)
+{
+	Text text;
+	if (len) {
+		char *s = (char *) alloc (len + 1);
+		memcpy (s, str, len);
+		s[len] = '\0';
+		text.s = s;
+		text.len = len;
+	}
+	return text;
+}
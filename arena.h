@@ -0,0 +1,48 @@
+// arena.h
+// memory for the news of a refresh (or of a cache batch), handed out in
+// order and given back all at once, when the last of them is gone
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <glib.h>
+#include <string>
+
+// a string that lives in an arena
+struct Text
+{
+	const char *s;
+	guint32 len;
+
+	Text() : s (""), len (0) {}
+	const char *c_str() const { return s; }
+	size_t size() const { return len; }
+	bool empty() const { return !len; }
+	std::string str() const { return std::string (s, len); }
+};
+
+class Arena
+{
+public:
+	Arena();  // with a reference held
+	void ref();
+	void unref();
+
+	void *alloc (size_t size);  // 8 bytes aligned
+	Text copy (const char *str, size_t len);
+	Text copy (const std::string &str) { return copy (str.data(), str.size()); }
+
+private:
+	struct Block {
+		Block *next;  // the data follows, 8 bytes aligned
+	};
+	Block *blocks;
+	char *p, *end;
+	volatile gint refs;
+
+	~Arena();
+	Arena (const Arena &);
+	Arena &operator = (const Arena &);
+};
+
+#endif /*ARENA_H*/
@@ -0,0 +1,506 @@
+// bench.cpp
+// timings of what eatfeed spends its time on; run by "make bench"
+// (build with optimizations; numbers are only comparable on the same machine)
+
+#include "date.h"
+#include "xmlparser.h"
+#include "jsonparser.h"
+#include "idset.h"
+#include "search.h"
+#include "dedup.h"
+#include "feed.h"
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk/gdk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <new>
+#include <string>
+#include <vector>
+
+// deterministic, so that runs are comparable
+static guint32 seed = 1;
+static guint32 random_nb (guint32 max)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % max;
+}
+
+// calls to operator new, as made for the news and their strings before
+// arenas. glib's and curl's allocations aren't counted, and neither are the
+// arenas' own blocks (one per 64 KB).
+static volatile gint allocations = 0;
+
+void *operator new (size_t size)
+{
+	g_atomic_int_inc (&allocations);
+	void *p = malloc (size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+// resident memory, in KB; 0 if unknown
+static long resident_kb()
+{
+	long pages, resident = 0;
+	FILE *file = fopen ("/proc/self/statm", "r");
+	if (file) {
+		if (fscanf (file, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose (file);
+	}
+	return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static void report (const char *what, GTimer *timer, double ops, const char *unit)
+{
+	double secs = g_timer_elapsed (timer, NULL);
+	printf ("  %-48s %10.1f ns/%s\n", what, secs * 1e9 / ops, unit);
+}
+
+// dates: the zone lookup is on the path of every news of every refresh
+
+static void bench_dates()
+{
+	static const char *zones[] = { "GMT", "UT", "EST", "PDT", "Z", "A", "Y", "+0100", "-0530", "CET" };
+	std::vector <std::string> dates;
+	for (int i = 0; i < 1000; i++) {
+		gchar *str = g_strdup_printf ("Mon, %02d Jan 2011 %02d:%02d:%02d %s",
+			1 + random_nb (28), random_nb (24), random_nb (60), random_nb (60),
+			zones [random_nb (G_N_ELEMENTS (zones))]);
+		dates.push_back (str);
+		g_free (str);
+	}
+	const int rounds = 200;
+	Date date;
+	GTimer *timer = g_timer_new();
+	for (int r = 0; r < rounds; r++)
+		for (size_t i = 0; i < dates.size(); i++)
+			parse_rfc822 (dates[i].c_str(), &date);
+	report ("parse_rfc822", timer, (double) rounds * dates.size(), "date");
+
+	g_timer_start (timer);
+	for (int r = 0; r < rounds; r++)
+		for (int i = 0; i < 1000; i++)
+			parse_rfc3339 ("2011-01-02T15:04:05.250+01:00", &date);
+	report ("parse_rfc3339", timer, rounds * 1000.0, "date");
+	g_timer_destroy (timer);
+}
+
+// parsers: the same feed, as RSS and as JSON Feed, into handlers that
+// do nothing, so that only the parsing is measured
+
+struct NullXml : public XmlParser::Handler
+{
+	virtual XmlParser::Handler *startElement (const char *name,
+		const char **attribute_names, const char **attribute_values, std::string &error)
+	{ return this; }
+	virtual void textElement (const char *name, const std::string &text, std::string &error) {}
+	virtual void endElement (const char *name, XmlParser::Handler *child, std::string &error) {}
+};
+
+struct NullJson : public JsonParser::Handler
+{
+	virtual JsonParser::Handler *startObject (const char *key, std::string &error)
+	{ return this; }
+	virtual void value (const char *key, const char *text, size_t len, std::string &error) {}
+	virtual void endObject (const char *key, JsonParser::Handler *child, std::string &error) {}
+};
+
+static void bench_parsers()
+{
+	const int items = 500;
+	std::string body (400, 'x');
+	std::string xml = "<?xml version=\"1.0\"?><rss version=\"2.0\"><channel><title>Bench</title>";
+	std::string json = "{\"version\": \"https://jsonfeed.org/version/1\", \"title\": \"Bench\", \"items\": [";
+	for (int i = 0; i < items; i++) {
+		gchar *item = g_strdup_printf ("<item><title>News %d</title>"
+			"<link>http://example.com/%d</link><guid>id%d</guid>"
+			"<pubDate>Mon, 02 Jan 2011 15:04:05 GMT</pubDate>"
+			"<description>%s &amp; more</description></item>",
+			i, i, i, body.c_str());
+		xml += item;
+		g_free (item);
+		item = g_strdup_printf ("%s{\"title\": \"News %d\", "
+			"\"url\": \"http://example.com/%d\", \"id\": \"id%d\", "
+			"\"date_published\": \"2011-01-02T15:04:05Z\", "
+			"\"content_html\": \"%s \\u0026 more\"}",
+			i ? ", " : "", i, i, i, body.c_str());
+		json += item;
+		g_free (item);
+	}
+	xml += "</channel></rss>";
+	json += "]}";
+
+	const int rounds = 20;
+	std::string error;
+	GTimer *timer = g_timer_new();
+	for (int r = 0; r < rounds; r++) {
+		NullXml handler;
+		XmlParser parser (&handler);
+		parser.parse (xml, error);
+	}
+	report ("XmlParser, RSS", timer, (double) rounds * xml.size(), "byte");
+
+	g_timer_start (timer);
+	for (int r = 0; r < rounds; r++) {
+		NullJson handler;
+		JsonParser parser (&handler);
+		parser.parse (json.data(), json.size(), error);
+		parser.finish (error);
+	}
+	report ("JsonParser, JSON Feed", timer, (double) rounds * json.size(), "byte");
+	g_timer_destroy (timer);
+	if (!error.empty())
+		printf ("  (error: %s)\n", error.c_str());
+}
+
+// read flags: the set of a large feed, as marked when showing its news
+
+static void bench_idset()
+{
+	const int n = 10000;
+	std::vector <guint64> ids, others;
+	for (int i = 0; i < n; i++) {
+		gchar *id = g_strdup_printf ("http://example.com/news/%d", i);
+		ids.push_back (IdSet::hash (id));
+		g_free (id);
+		id = g_strdup_printf ("http://example.com/other/%d", i);
+		others.push_back (IdSet::hash (id));
+		g_free (id);
+	}
+	const int rounds = 50;
+	double inserting = 0, removing = 0;
+	GTimer *timer = g_timer_new();
+	for (int r = 0; r < rounds; r++) {
+		IdSet set;
+		g_timer_start (timer);
+		for (int i = 0; i < n; i++)
+			set.insert (ids[i]);
+		inserting += g_timer_elapsed (timer, NULL);
+		g_timer_start (timer);
+		for (int i = 0; i < n; i++)
+			set.remove (ids[i]);
+		removing += g_timer_elapsed (timer, NULL);
+	}
+	printf ("  %-48s %10.1f ns/id\n", "IdSet::insert, 10k ids", inserting * 1e9 / rounds / n);
+	printf ("  %-48s %10.1f ns/id\n", "IdSet::remove, 10k ids", removing * 1e9 / rounds / n);
+
+	IdSet set;
+	for (int i = 0; i < n; i++)
+		set.insert (ids[i]);
+	int found = 0;
+	g_timer_start (timer);
+	for (int r = 0; r < rounds; r++)
+		for (int i = 0; i < n; i++)
+			found += set.contains (ids[i]);
+	report ("IdSet::contains, present", timer, (double) rounds * n, "id");
+
+	g_timer_start (timer);
+	for (int r = 0; r < rounds; r++)
+		for (int i = 0; i < n; i++)
+			found += set.contains (others[i]);
+	report ("IdSet::contains, absent", timer, (double) rounds * n, "id");
+
+	g_timer_destroy (timer);
+	if (found != rounds * n)
+		printf ("  (found %d, expected %d)\n", found, rounds * n);
+}
+
+// search: a query over the news of many feeds, as typed in the search bar
+
+static void bench_search()
+{
+	const int docs = 50000, vocabulary = 5000;
+	std::vector <std::string> words;
+	for (int i = 0; i < vocabulary; i++) {
+		gchar *word = g_strdup_printf ("w%dx", i);
+		words.push_back (word);
+		g_free (word);
+	}
+	SearchIndex index;
+	GTimer *timer = g_timer_new();
+	for (int d = 0; d < docs; d++) {
+		std::string text;
+		for (int i = 0; i < 40; i++) {
+			// skewed: low numbers are common words
+			guint32 w = random_nb (vocabulary);
+			w = random_nb (w+1);
+			text += words[w] + " ";
+		}
+		index.add (GINT_TO_POINTER (d+1), text);
+	}
+	report ("SearchIndex::add, 40 words", timer, docs, "doc");
+
+	static const char *queries[] = { "w0x", "w4000x", "w1x w2x", "w10x w3000x", "w0x w1x w2x w3x" };
+	const int rounds = 20;
+	for (unsigned int q = 0; q < G_N_ELEMENTS (queries); q++) {
+		size_t hits = 0;
+		g_timer_start (timer);
+		for (int r = 0; r < rounds; r++) {
+			std::vector <gpointer> results;
+			index.search (queries[q], &results);
+			hits = results.size();
+		}
+		gchar *what = g_strdup_printf ("SearchIndex::search \"%s\" (%lu hits)",
+			queries[q], (unsigned long) hits);
+		report (what, timer, rounds, "query");
+		g_free (what);
+	}
+	g_timer_destroy (timer);
+}
+
+// duplicates: fingerprinting and looking up each news of a refresh, with
+// indexes of two sizes, as it should cost the same with either
+
+static void bench_dedup()
+{
+	std::vector <std::string> words;
+	for (int i = 0; i < 5000; i++) {
+		gchar *word = g_strdup_printf ("w%dx", i);
+		words.push_back (word);
+		g_free (word);
+	}
+	static const int sizes[] = { 10000, 100000 };
+	for (unsigned int s = 0; s < G_N_ELEMENTS (sizes); s++) {
+		const int n = sizes[s];
+		std::vector <std::string> links (n), texts (n);
+		for (int i = 0; i < n; i++) {
+			gchar *link = g_strdup_printf ("https://www.site%d.example.com/post/%d/?utm_source=rss",
+				random_nb (300), i);
+			links[i] = link;
+			g_free (link);
+			for (int w = 0; w < 40; w++)
+				texts[i] += words [random_nb (words.size())] + " ";
+		}
+		std::vector <DupIndex::Fingerprint> fps (n);
+		GTimer *timer = g_timer_new();
+		for (int i = 0; i < n; i++)
+			fps[i] = DupIndex::fingerprint (links[i], texts[i]);
+		gchar *what = g_strdup_printf ("DupIndex::fingerprint, %dk news", n / 1000);
+		report (what, timer, n, "news");
+		g_free (what);
+
+		DupIndex dups;
+		int found = 0;
+		g_timer_start (timer);
+		for (int i = 0; i < n; i++) {
+			// each news is its own group, so that any earlier one is found
+			found += dups.find (fps[i], GINT_TO_POINTER (i+1)) != NULL;
+			dups.add (GINT_TO_POINTER (i+1), fps[i], GINT_TO_POINTER (i+1));
+		}
+		what = g_strdup_printf ("DupIndex::find + add, %dk news", n / 1000);
+		report (what, timer, n, "news");
+		g_free (what);
+		g_timer_destroy (timer);
+		if (found)
+			printf ("  (%d taken for duplicates)\n", found);
+	}
+}
+
+// startup: Manager::loadConfig() of 5000 feeds in 20 folders, with 1M read
+// news between them, from the state snapshot. eatfeed's files go to a home
+// of their own, emptied first. The snapshot was just written, so it is in
+// the page cache: this is a warm start.
+
+#define STARTUP_FEEDS 5000
+#define STARTUP_FOLDERS 20
+#define STARTUP_READS 200  // per feed
+// in milliseconds
+#define STARTUP_TARGET 100
+#define REFRESH_FEEDS 300
+#define REFRESH_NEWS 50  // per feed
+
+static void empty_dir (const std::string &path)
+{
+	GDir *dir = g_dir_open (path.c_str(), 0, NULL);
+	if (!dir)
+		return;
+	const gchar *name;
+	while ((name = g_dir_read_name (dir))) {
+		gchar *file = g_build_filename (path.c_str(), name, NULL);
+		g_unlink (file);
+		g_free (file);
+	}
+	g_dir_close (dir);
+}
+
+static std::string bench_home()
+{
+	gchar *home = g_build_filename (g_get_tmp_dir(), "eatfeed-bench", NULL);
+	std::string str (home);
+	g_free (home);
+	return str;
+}
+
+// the first ones are files, for the refresh below; the others are never fetched
+static std::string feed_url (const std::string &home, int nb)
+{
+	gchar *url = nb < REFRESH_FEEDS ?
+		g_strdup_printf ("file://%s/feeds/%d.xml", home.c_str(), nb) :
+		g_strdup_printf ("http://example.com/%d/feed.xml", nb);
+	std::string str (url);
+	g_free (url);
+	return str;
+}
+
+static void bench_startup()
+{
+	std::string home = bench_home(), dir = home + "/.eatfeed.d";
+	empty_dir (dir);
+	g_unlink ((home + "/.eatfeed").c_str());
+	if (g_mkdir_with_parents (dir.c_str(), 0700)) {
+		printf ("  couldn't create %s\n", dir.c_str());
+		exit (1);
+	}
+	g_setenv ("HOME", home.c_str(), TRUE);
+
+	Snapshot::Builder builder ((ParseLimits()), (Retention()));
+	for (int i = 0; i < STARTUP_FOLDERS; i++) {
+		gchar *name = g_strdup_printf ("Folder %d", i);
+		builder.addFolder (name, -1, true);
+		g_free (name);
+	}
+	for (int f = 0; f < STARTUP_FEEDS; f++) {
+		IdSet read;
+		for (int i = 0; i < STARTUP_READS; i++)
+			read.insert (((guint64) f << 32) + random_nb (1 << 30) + 1);
+		gchar *title = g_strdup_printf ("Feed %d", f);
+		builder.addFeed (feed_url (home, f), title, "", Retention (-1, -1, -1), read,
+			f % STARTUP_FOLDERS);
+		g_free (title);
+	}
+	std::string data;
+	builder.finish (&data);
+	if (!g_file_set_contents ((dir + "/state").c_str(), data.data(), data.size(), NULL)) {
+		printf ("  couldn't write %s/state\n", dir.c_str());
+		exit (1);
+	}
+
+	GTimer *timer = g_timer_new();
+	Manager *manager = Manager::get();
+	double ms = g_timer_elapsed (timer, NULL) * 1000;
+	g_timer_destroy (timer);
+	printf ("  %-48s %10.1f ms (%s the %d ms target)\n",
+		"Manager::loadConfig, 5000 feeds, 1M read ids", ms,
+		ms < STARTUP_TARGET ? "under" : "OVER", STARTUP_TARGET);
+	if (manager->feedsNb() != STARTUP_FEEDS || manager->foldersNb() != STARTUP_FOLDERS)
+		printf ("  (loaded %d feeds and %d folders)\n", manager->feedsNb(), manager->foldersNb());
+}
+
+// news memory: a full refresh of 300 of those feeds, read from files, each
+// parsed in its thread and merged by the manager as from the network
+
+struct RefreshListener : public Manager::Listener
+{
+	int loaded;
+	GMainLoop *loop;
+
+	RefreshListener() : loaded (0), loop (g_main_loop_new (NULL, FALSE)) {}
+	~RefreshListener() { g_main_loop_unref (loop); }
+
+	virtual void feedsLoaded (Manager *manager, const std::vector <Feed *> &feeds)
+	{
+		loaded += feeds.size();
+		if (loaded >= REFRESH_FEEDS)
+			g_main_loop_quit (loop);
+	}
+	virtual void feedsChanged (Manager *manager, const std::vector <Feed *> &feeds) {}
+	virtual void feedsLoadingProgress (Manager *manager, float fraction) {}
+	virtual void feedAdded (Manager *manager, Feed *feed) {}
+	virtual void feedRemoved (Manager *manager, Feed *feed, int old_pos) {}
+	virtual void feedMoved (Manager *manager, Feed *feed, int old_pos) {}
+	virtual void foldersChanged (Manager *manager) {}
+};
+
+static void bench_refresh()
+{
+	std::string home = bench_home(), dir = home + "/feeds";
+	empty_dir (dir);
+	g_mkdir_with_parents (dir.c_str(), 0700);
+	std::string body (600, 'x');
+	for (int f = 0; f < REFRESH_FEEDS; f++) {
+		std::string xml = "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+			"<rss version=\"2.0\"><channel><title>Bench</title>";
+		for (int i = 0; i < REFRESH_NEWS; i++) {
+			gchar *item = g_strdup_printf ("<item><title>News %d of feed %d</title>"
+				"<link>http://site%d.example.com/%d/%d</link><guid>%d-%d</guid>"
+				"<pubDate>Mon, %02d Jan 2011 15:04:05 GMT</pubDate>"
+				"<author>author%d@example.com</author>"
+				"<category>topic%d</category><category>topic%d</category>"
+				"<description>%s &amp; %d</description></item>",
+				i, f, f % 50, f, i, f, i, 1 + i % 28, random_nb (100),
+				random_nb (30), random_nb (30), body.c_str(), i);
+			xml += item;
+			g_free (item);
+		}
+		xml += "</channel></rss>";
+		gchar *path = g_strdup_printf ("%s/%d.xml", dir.c_str(), f);
+		bool ok = g_file_set_contents (path, xml.data(), xml.size(), NULL);
+		g_free (path);
+		if (!ok) {
+			printf ("  couldn't write %s\n", dir.c_str());
+			return;
+		}
+	}
+
+	Manager *manager = Manager::get();
+	std::vector <Feed *> feeds;
+	for (int f = 0; f < REFRESH_FEEDS; f++)
+		if (Feed *feed = manager->findFeed (feed_url (home, f)))
+			feeds.push_back (feed);
+	RefreshListener listener;
+	manager->addListener (&listener);
+
+	long resident = resident_kb();
+	gint allocated = g_atomic_int_get (&allocations);
+	GTimer *timer = g_timer_new();
+	gdk_threads_enter();  // as from the ui
+	for (unsigned int i = 0; i < feeds.size(); i++)
+		feeds[i]->refresh();
+	gdk_threads_leave();
+	g_main_loop_run (listener.loop);
+	double ms = g_timer_elapsed (timer, NULL) * 1000;
+	g_timer_destroy (timer);
+	allocated = g_atomic_int_get (&allocations) - allocated;
+	manager->removeListener (&listener);
+
+	int news = 0;
+	std::string error;
+	for (unsigned int i = 0; i < feeds.size(); i++) {
+		news += feeds[i]->newsNb();
+		if (error.empty())
+			error = feeds[i]->errorMsg();
+	}
+	printf ("  %-48s %10.1f ms\n", "Feed::refresh, 300 feeds of 50 news", ms);
+	printf ("  %-48s %10d (%.1f a news)\n", "operator new calls", allocated,
+		news ? (double) allocated / news : 0.0);
+	printf ("  %-48s %10.1f MB (%.1f MB more)\n", "resident memory after",
+		resident_kb() / 1024.0, (resident_kb() - resident) / 1024.0);
+	if (news != REFRESH_FEEDS * REFRESH_NEWS)
+		printf ("  (got %d news; error: %s)\n", news, error.c_str());
+}
+
+int main()
+{
+	g_thread_init (NULL);
+	gdk_threads_init();
+
+	printf ("dates:\n");
+	bench_dates();
+	printf ("parsers:\n");
+	bench_parsers();
+	printf ("read flags:\n");
+	bench_idset();
+	printf ("search:\n");
+	bench_search();
+	printf ("duplicates:\n");
+	bench_dedup();
+	printf ("startup:\n");
+	bench_startup();
+	printf ("news memory:\n");
+	bench_refresh();
+	return 0;
+}
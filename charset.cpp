@@ -0,0 +1,315 @@
+// charset.cpp
+
+#include "charset.h"
+#include <string.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// utf-8 validation
+
+static inline size_t ascii_prefix (const unsigned char *s, size_t len)
+{
+	// ascii is the bulk of any feed: test 16 (or 8) bytes at a time
+	size_t i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		int mask = _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *) (s + i)));
+		if (mask)
+			return i + g_bit_nth_lsf (mask, -1);
+	}
+#endif
+	for (; i + 8 <= len; i += 8) {
+		guint64 word;
+		memcpy (&word, s + i, 8);
+		if (word & G_GUINT64_CONSTANT (0x8080808080808080))
+			break;
+	}
+	while (i < len && s[i] < 0x80)
+		i++;
+	return i;
+}
+
+// length of the sequence at s, 0 if cut short by the buffer end, -1 if invalid
+static int utf8_sequence (const unsigned char *s, size_t avail)
+{
+	unsigned char c = s[0], lo = 0x80, hi = 0xbf;
+	int n;
+	if (c < 0x80)
+		return 1;
+	else if (c < 0xc2)  // continuation byte or overlong
+		return -1;
+	else if (c < 0xe0)
+		n = 2;
+	else if (c < 0xf0) {
+		n = 3;
+		if (c == 0xe0) lo = 0xa0;  // overlong
+		else if (c == 0xed) hi = 0x9f;  // surrogates
+	}
+	else if (c < 0xf5) {
+		n = 4;
+		if (c == 0xf0) lo = 0x90;  // overlong
+		else if (c == 0xf4) hi = 0x8f;  // above U+10FFFF
+	}
+	else
+		return -1;
+	for (int i = 1; i < n; i++) {
+		if ((size_t) i >= avail)
+			return 0;
+		if (s[i] < lo || s[i] > hi)
+			return -1;
+		lo = 0x80; hi = 0xbf;
+	}
+	return n;
+}
+
+size_t utf8_valid_prefix (const char *text, size_t len)
+{
+	const unsigned char *s = (const unsigned char *) text;
+	size_t i = 0;
+	while (true) {
+		i += ascii_prefix (s + i, len - i);
+		if (i == len)
+			break;
+		int n = utf8_sequence (s + i, len - i);
+		if (n <= 0)
+			break;
+		i += n;
+	}
+	return i;
+}
+
+// detection
+
+static bool is_utf8_name (const std::string &codeset)
+{
+	return !g_ascii_strcasecmp (codeset.c_str(), "utf-8") ||
+	       !g_ascii_strcasecmp (codeset.c_str(), "utf8");
+}
+
+// value of attribute in a <?xml ... ?> declaration
+static std::string xml_decl_value (const std::string &decl, const char *attribute)
+{
+	std::string::size_type i = decl.find (attribute);
+	if (i == std::string::npos)
+		return "";
+	i = decl.find_first_of ("\"'", i);
+	if (i == std::string::npos)
+		return "";
+	std::string::size_type j = decl.find (decl[i], i+1);
+	if (j == std::string::npos)
+		return "";
+	return decl.substr (i+1, j-i-1);
+}
+
+Transcoder::Transcoder (Sink *sink, const std::string &codeset)
+: sink (sink), _codeset (codeset), cd ((GIConv) -1), detected (false),
+  declared (false), utf8 (true), offset (0)
+{}
+
+Transcoder::~Transcoder()
+{
+	if (cd != (GIConv) -1)
+		g_iconv_close (cd);
+}
+
+void Transcoder::setContentType (const std::string &content_type)
+{
+	// e.g. "text/xml; charset=ISO-8859-1"
+	std::string type (content_type);
+	for (unsigned int i = 0; i < type.size(); i++)
+		type[i] = g_ascii_tolower (type[i]);
+	std::string::size_type i = type.find ("charset=");
+	http_codeset.clear();
+	if (i == std::string::npos)
+		return;
+	i += 8;
+	std::string::size_type j = type.find_first_of ("; \t\r\n", i);
+	http_codeset = content_type.substr (i, j == std::string::npos ? j : j-i);
+	if (!http_codeset.empty() && (http_codeset[0] == '"' || http_codeset[0] == '\''))
+		http_codeset = http_codeset.substr (1, http_codeset.size()-2);
+}
+
+bool Transcoder::detect (bool last, std::string &error)
+{
+	// precedence: user, byte order mark, http header, xml declaration
+	const unsigned char *s = (const unsigned char *) pending.data();
+	size_t len = pending.size(), skip = 0;
+	if (len < 4 && !last)
+		return true;  // wait for more
+
+	std::string found;
+	if (len >= 3 && s[0] == 0xef && s[1] == 0xbb && s[2] == 0xbf)
+		{ found = "UTF-8"; skip = 3; }
+	else if (len >= 2 && s[0] == 0xff && s[1] == 0xfe)
+		{ found = "UTF-16LE"; skip = 2; }
+	else if (len >= 2 && s[0] == 0xfe && s[1] == 0xff)
+		{ found = "UTF-16BE"; skip = 2; }
+	else if (len >= 4 && !memcmp (s, "<\0?\0", 4))
+		found = "UTF-16LE";
+	else if (len >= 4 && !memcmp (s, "\0<\0?", 4))
+		found = "UTF-16BE";
+
+	if (found.empty() && http_codeset.empty() && !pending.compare (0, 5, "<?xml")) {
+		std::string::size_type end = pending.find ("?>");
+		if (end == std::string::npos && len < 1024 && !last)
+			return true;  // wait for the whole declaration
+		found = xml_decl_value (pending.substr (0, end), "encoding");
+	}
+
+	std::string codeset (_codeset);
+	if (codeset.empty()) codeset = found;
+	if (codeset.empty()) codeset = http_codeset;
+	declared = !codeset.empty();
+	if (codeset.empty()) codeset = "UTF-8";
+
+	detected = true;
+	if (!setCodeset (codeset, error))
+		return false;
+	std::string head (pending, skip);
+	pending.clear();
+	return feed (head.data(), head.size(), last, error);
+}
+
+bool Transcoder::setCodeset (const std::string &codeset, std::string &error)
+{
+	_codeset = codeset;
+	utf8 = is_utf8_name (codeset);
+	if (!utf8) {
+		cd = g_iconv_open ("UTF-8", codeset.c_str());
+		if (cd == (GIConv) -1) {
+			error = "Unsupported codeset: " + codeset;
+			return false;
+		}
+	}
+	return true;
+}
+
+// conversion
+
+bool Transcoder::write (const char *data, size_t len, std::string &error)
+{
+	if (!detected) {
+		pending.append (data, len);
+		return detect (false, error);
+	}
+	return feed (data, len, false, error);
+}
+
+bool Transcoder::close (std::string &error)
+{
+	if (!detected)
+		return detect (true, error);
+	return feed (NULL, 0, true, error);
+}
+
+bool Transcoder::feed (const char *data, size_t len, bool last, std::string &error)
+{
+	if (utf8)
+		return feedUtf8 (data, len, last, error);
+	return feedIconv (data, len, last, error);
+}
+
+bool Transcoder::feedUtf8 (const char *data, size_t len, bool last, std::string &error)
+{
+	if (!pending.empty()) {  // complete the sequence cut by the last chunk
+		const unsigned char *s = (const unsigned char *) pending.data();
+		int n;
+		while ((n = utf8_sequence (s, pending.size())) == 0 && len) {
+			pending += *data++;
+			len--;
+			s = (const unsigned char *) pending.data();
+		}
+		if (n == 0 && !last)
+			return true;
+		if (n > 0) {
+			if (!sink->write (pending.data(), pending.size(), error))
+				return false;
+			offset += pending.size();
+			pending.clear();
+		}
+		else {  // let the code below deal with it
+			std::string rest (pending);
+			rest.append (data, len);
+			pending.clear();
+			return feedUtf8 (rest.data(), rest.size(), last, error);
+		}
+	}
+
+	// fast path: the text is handed over as it came
+	size_t valid = utf8_valid_prefix (data, len);
+	if (valid && !sink->write (data, valid, error))
+		return false;
+	offset += valid;
+	if (valid == len)
+		return true;
+
+	data += valid; len -= valid;
+	if (!last && utf8_sequence ((const unsigned char *) data, len) == 0) {
+		pending.assign (data, len);
+		return true;
+	}
+	if (declared) {
+		gchar *str = g_strdup_printf ("Invalid UTF-8 text at byte %lu (try setting "
+			"the codeset)", (unsigned long) offset);
+		error = str;
+		g_free (str);
+		return false;
+	}
+	// nothing told us it was utf-8: most likely a windows/latin-1 document
+	if (!setCodeset ("WINDOWS-1252", error))
+		return false;
+	return feedIconv (data, len, last, error);
+}
+
+bool Transcoder::feedIconv (const char *data, size_t len, bool last, std::string &error)
+{
+	std::string joined;
+	if (!pending.empty()) {
+		joined = pending;
+		joined.append (data, len);
+		pending.clear();
+		data = joined.data(); len = joined.size();
+	}
+
+	gchar *inbuf = (gchar *) data;
+	gsize inleft = len;
+	char buffer [8192];
+	while (inleft) {
+		gchar *outbuf = buffer;
+		gsize outleft = sizeof (buffer);
+		gsize ret = g_iconv (cd, &inbuf, &inleft, &outbuf, &outleft);
+		int err = errno;
+		if (outbuf > buffer && !sink->write (buffer, outbuf - buffer, error))
+			return false;
+		if (ret != (gsize) -1)
+			continue;
+		if (err == E2BIG)
+			continue;
+		if (err == EINVAL && !last) {  // cut short: wait for the next chunk
+			pending.assign (inbuf, inleft);
+			break;
+		}
+		gchar *str = g_strdup_printf ("Invalid %s text at byte %lu",
+			_codeset.c_str(), (unsigned long) (offset + (inbuf - data)));
+		error = str;
+		g_free (str);
+		return false;
+	}
+	offset += len - pending.size();
+	if (last) {  // stateful codesets may have a last shift sequence to put out
+		gchar *outbuf = buffer;
+		gsize outleft = sizeof (buffer);
+		gsize ret = g_iconv (cd, NULL, NULL, &outbuf, &outleft);
+		if (outbuf > buffer && !sink->write (buffer, outbuf - buffer, error))
+			return false;
+		if (ret == (gsize) -1) {
+			gchar *str = g_strdup_printf ("Invalid %s text at its end", _codeset.c_str());
+			error = str;
+			g_free (str);
+			return false;
+		}
+	}
+	return true;
+}
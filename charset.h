@@ -0,0 +1,51 @@
+// charset.h
+// detects the encoding of a feed and converts it to utf-8 while it streams in
+
+#ifndef CHARSET_H
+#define CHARSET_H
+
+#include <glib.h>
+#include <string>
+
+// length of the longest valid utf-8 prefix of text; a multi-byte sequence
+// cut short by the end of the buffer is left out, so that the caller may
+// complete it with the next chunk
+size_t utf8_valid_prefix (const char *text, size_t len);
+
+class Transcoder
+{
+public:
+	struct Sink {
+		virtual bool write (const char *text, size_t len, std::string &error) = 0;
+	};
+
+	// codeset: forced by the user (empty to detect it)
+	Transcoder (Sink *sink, const std::string &codeset);
+	~Transcoder();
+
+	// charset parameter of the http Content-Type header, if any; the
+	// header of each response (e.g. of a redirect) replaces the last one's
+	void setContentType (const std::string &content_type);
+
+	// you may break the document into various calls
+	bool write (const char *data, size_t len, std::string &error);
+	bool close (std::string &error);
+
+	const std::string &codeset() const { return _codeset; }
+
+private:
+	Sink *sink;
+	std::string _codeset, http_codeset;
+	std::string pending;  // bytes held back: document head, cut sequences
+	GIConv cd;
+	bool detected, declared, utf8;
+	size_t offset;
+
+	bool detect (bool last, std::string &error);
+	bool setCodeset (const std::string &codeset, std::string &error);
+	bool feed (const char *data, size_t len, bool last, std::string &error);
+	bool feedUtf8 (const char *data, size_t len, bool last, std::string &error);
+	bool feedIconv (const char *data, size_t len, bool last, std::string &error);
+};
+
+#endif /*CHARSET_H*/
@@ -0,0 +1,331 @@
+// check.cpp
+// tests of the parts that need no ui; run by "make check"
+
+#include "date.h"
+#include "jsonparser.h"
+#include "idset.h"
+#include "search.h"
+#include "dedup.h"
+#include "snapshot.h"
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf ("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+// dates
+
+static void check_dates()
+{
+	// every zone of the perfect hash, and then some that aren't
+	static const struct { const char *name; int offset; } zones[] = {
+		{ "UT", 0 }, { "UTC", 0 }, { "GMT", 0 }, { "Z", 0 },
+		{ "EST", -300 }, { "EDT", -240 }, { "CST", -360 }, { "CDT", -300 },
+		{ "MST", -420 }, { "MDT", -360 }, { "PST", -480 }, { "PDT", -420 },
+		{ "A", -60 }, { "B", -120 }, { "C", -180 }, { "D", -240 }, { "E", -300 },
+		{ "F", -360 }, { "G", -420 }, { "H", -480 }, { "I", -540 }, { "K", -600 },
+		{ "L", -660 }, { "M", -720 }, { "N", 60 }, { "O", 120 }, { "P", 180 },
+		{ "Q", 240 }, { "R", 300 }, { "S", 360 }, { "T", 420 }, { "U", 480 },
+		{ "V", 540 }, { "W", 600 }, { "X", 660 }, { "Y", 720 }, { "est", -300 },
+	};
+	for (unsigned int i = 0; i < G_N_ELEMENTS (zones); i++) {
+		std::string text = std::string ("Mon, 02 Jan 2006 15:04:05 ") + zones[i].name;
+		Date date;
+		CHECK (parse_rfc822 (text.c_str(), &date));
+		CHECK (date.flags & Date::KNOWN_ZONE);
+		CHECK (date.zone == zones[i].offset);
+		CHECK (date.time == 1136214245 - zones[i].offset * 60);
+	}
+	static const char *unknown[] = { "J", "CET", "ESTX", "GM" };
+	for (unsigned int i = 0; i < G_N_ELEMENTS (unknown); i++) {
+		std::string text = std::string ("02 Jan 2006 15:04:05 ") + unknown[i];
+		Date date;
+		CHECK (parse_rfc822 (text.c_str(), &date));
+		CHECK (!(date.flags & Date::KNOWN_ZONE));
+		CHECK (date.time == 1136214245);
+	}
+
+	Date a, b, c;
+	CHECK (parse_rfc822 ("Mon, 02 Jan 2006 15:04:05 +0100", &a));
+	CHECK (parse_rfc822 ("2 Jan 06 14:04 GMT", &b));  // no weekday nor seconds
+	CHECK (a.time == b.time + 5);
+	CHECK (parse_rfc3339 ("2006-01-02T15:04:05.250+01:00", &c));
+	CHECK (c.time == a.time && c.zone == 60);
+	CHECK (parse_rfc3339 ("2006-01-02T14:04:05Z", &c));
+	CHECK (c.time == a.time);
+
+	Date untouched;
+	CHECK (!parse_rfc822 ("yesterday", &untouched));
+	CHECK (!parse_rfc3339 ("2006-13", &untouched));
+	CHECK (!untouched.valid());
+}
+
+// json
+
+struct JsonLog : public JsonParser::Handler
+{
+	std::string log;
+
+	virtual JsonParser::Handler *startObject (const char *key, std::string &error)
+	{
+		log += std::string ("{") + (key ? key : "");
+		return key && !strcmp (key, "skip") ? NULL : this;
+	}
+	virtual void value (const char *key, const char *text, size_t len, std::string &error)
+	{ log += std::string (" ") + (key ? key : "") + "=" + std::string (text, len); }
+	virtual void endObject (const char *key, JsonParser::Handler *child, std::string &error)
+	{ log += "}"; }
+};
+
+// the log, or "!" if it failed
+static std::string parse_json (const char *text, size_t chunk = 0)
+{
+	JsonLog log;
+	JsonParser parser (&log);
+	std::string error;
+	size_t len = strlen (text);
+	if (!chunk)
+		chunk = len;
+	bool ok = true;
+	for (size_t i = 0; ok && i < len; i += chunk)
+		ok = parser.parse (text + i, MIN (chunk, len - i), error);
+	if (!ok || !parser.finish (error))
+		return "!";
+	return log.log;
+}
+
+static void check_json()
+{
+	const char *doc = "{\"a\": 1, \"skip\": {\"b\": 2, \"c\": {\"d\": 3}},"
+		" \"e\": [true, {\"f\": \"x\\\"y\"}], \"n\": null}";
+	std::string log = parse_json (doc);
+	CHECK (log == "{ a=1{skip} e=true{e f=x\"y}}");  // skipped, but closed
+	CHECK (parse_json (doc, 1) == log);  // in bits
+	CHECK (parse_json (doc, 7) == log);
+
+	CHECK (parse_json ("{\"s\": \"\\u00e9\\ud83d\\ude00\"}") == "{ s=\xc3\xa9\xf0\x9f\x98\x80}");
+	CHECK (parse_json ("{\"s\": \"\\ud83d!\"}") == "{ s=\xef\xbf\xbd!}");  // unpaired
+	CHECK (parse_json ("{\"s\": \"\\ud83d\"}") == "{ s=\xef\xbf\xbd}");
+	CHECK (parse_json ("{\"s\": \"\\ud83d\\ud83d\\ude00\"}") == "{ s=\xef\xbf\xbd\xf0\x9f\x98\x80}");
+	CHECK (parse_json ("12") == " =12");
+	CHECK (parse_json ("{\"a\": [true, false, 0, -0.5e+3, 1E2]}") == "{ a=true a=false a=0 a=-0.5e+3 a=1E2}");
+
+	// literals json doesn't have
+	static const char *literals[] = { "foo", "tru", "nulls", "True", "01", "-", "+1",
+		"1.", ".5", "1e", "1e+", "0x1f", "1.2.3", "--1" };
+	for (unsigned int i = 0; i < G_N_ELEMENTS (literals); i++) {
+		std::string doc = std::string ("{\"title\": ") + literals[i] + "}";
+		CHECK (parse_json (doc.c_str()) == "!");
+		CHECK (parse_json (literals[i]) == "!");
+	}
+
+	// cut short, or not json
+	CHECK (parse_json ("{\"a\": 1") == "!");
+	CHECK (parse_json ("{\"a\": \"text") == "!");
+	CHECK (parse_json ("[1, 2") == "!");
+	CHECK (parse_json ("") == "!");
+	CHECK (parse_json ("{\"a\": 1} x") == "!");
+	CHECK (parse_json ("{\"a\" 1}") == "!");
+	CHECK (parse_json ("{\"a\": \"\x01\"}") == "!");
+}
+
+// read flags
+
+static void check_idset()
+{
+	IdSet set;
+	const int n = 10000;
+	for (int i = 0; i < n; i++) {
+		gchar *id = g_strdup_printf ("id%d", i);
+		set.insert (IdSet::hash (id));
+		g_free (id);
+	}
+	CHECK (set.size() == (size_t) n);
+	set.insert (IdSet::hash ("id0"));  // already there
+	CHECK (set.size() == (size_t) n);
+
+	// removing shifts back the ids after it: the others must still be found
+	for (int i = 0; i < n; i += 2) {
+		gchar *id = g_strdup_printf ("id%d", i);
+		set.remove (IdSet::hash (id));
+		g_free (id);
+	}
+	CHECK (set.size() == (size_t) n / 2);
+	int wrong = 0;
+	for (int i = 0; i < n; i++) {
+		gchar *id = g_strdup_printf ("id%d", i);
+		if (set.contains (std::string (id)) != (i % 2 == 1))
+			wrong++;
+		g_free (id);
+	}
+	CHECK (wrong == 0);
+
+	std::string data;
+	set.save (&data);
+	IdSet loaded;
+	CHECK (loaded.load (data));
+	CHECK (loaded.size() == set.size() && loaded.contains (std::string ("id1")));
+
+	IdSet attached;
+	CHECK (attached.attach (set.table(), set.tableSize(), set.size()));
+	CHECK (attached.contains (std::string ("id3")) && !attached.contains (std::string ("id2")));
+	attached.remove (std::string ("id3"));  // copies the table first
+	CHECK (!attached.contains (std::string ("id3")) && set.contains (std::string ("id3")));
+}
+
+// search
+
+static void check_search()
+{
+	SearchIndex index;
+	std::vector <guint32> docs;
+	// gaps of one, two and three bytes between the postings of "rare"
+	for (int i = 1; i <= 20000; i++) {
+		bool rare = i == 1 || i == 2 || i == 200 || i == 20000;
+		std::string text = rare ? "a <b>rare</b> Word" : "common word";
+		docs.push_back (index.add (GINT_TO_POINTER (i), text));
+	}
+	std::vector <gpointer> results;
+	index.search ("rare", &results);
+	CHECK (results.size() == 4);
+	if (results.size() == 4) {  // latest first
+		CHECK (GPOINTER_TO_INT (results[0]) == 20000);
+		CHECK (GPOINTER_TO_INT (results[1]) == 200);
+		CHECK (GPOINTER_TO_INT (results[3]) == 1);
+	}
+	results.clear();
+	index.search ("RARE word", &results);
+	CHECK (results.size() == 4);
+	results.clear();
+	index.search ("b", &results);  // markup isn't indexed
+	CHECK (results.empty());
+
+	index.remove (docs[199]);
+	index.replace (docs[0], GINT_TO_POINTER (-1));
+	results.clear();
+	index.search ("rare", &results);
+	CHECK (results.size() == 3);
+	if (results.size() == 3) {
+		CHECK (GPOINTER_TO_INT (results[1]) == 2);
+		CHECK (GPOINTER_TO_INT (results[2]) == -1);
+	}
+
+	std::vector <std::string> keys (1, "author:7");
+	index.add (GINT_TO_POINTER (1), "", keys);
+	results.clear();
+	index.lookup ("author:7", &results);
+	CHECK (results.size() == 1);
+}
+
+// duplicates
+
+static void check_canonical_links()
+{
+	static const struct { const char *link, *canonical; } links[] = {
+		{ "http://www.Example.com/a/", "http://example.com/a" },
+		{ "HTTPS://example.com/a", "http://example.com/a" },
+		{ "http://example.com:80/a", "http://example.com/a" },
+		{ "https://example.com:443/a", "http://example.com/a" },
+		{ "http://example.com:8080/a", "http://example.com:8080/a" },
+		{ "http://example.com:8000/a", "http://example.com:8000/a" },
+		{ "https://example.com:4430/a", "http://example.com:4430/a" },
+		{ "http://example.com:443/a", "http://example.com:443/a" },
+		{ "https://example.com:80/a", "http://example.com:80/a" },
+		{ "http://example.com/a?utm_source=x&id=3&fbclid=y#top", "http://example.com/a?id=3" },
+		{ "http://example.com/a?gclid=z", "http://example.com/a" },
+		{ "not a link", "not a link" },
+	};
+	for (unsigned int i = 0; i < G_N_ELEMENTS (links); i++) {
+		std::string canonical = DupIndex::canonicalLink (links[i].link);
+		if (canonical != links[i].canonical)
+			printf ("  %s -> %s\n", links[i].link, canonical.c_str());
+		CHECK (canonical == links[i].canonical);
+	}
+
+	DupIndex dups;
+	int group1, group2, item1, item2;
+	DupIndex::Fingerprint fp = DupIndex::fingerprint ("http://example.com/a", "");
+	dups.add (&item1, fp, &group1);
+	CHECK (dups.find (DupIndex::fingerprint ("https://www.example.com/a/", ""), &group2) == &item1);
+	CHECK (dups.find (fp, &group1) == NULL);  // not within its own group
+	CHECK (dups.find (DupIndex::fingerprint ("http://example.com:8080/a", ""), &group2) == NULL);
+	dups.replace (&item1, &item2, fp);
+	CHECK (dups.find (fp, &group2) == &item2);
+	dups.remove (&item2, fp);
+	CHECK (dups.find (fp, &group2) == NULL);
+}
+
+// state snapshot
+
+static void check_snapshot()
+{
+	IdSet read1, read2;
+	read1.insert (std::string ("a"));
+	read1.insert (std::string ("b"));
+	Snapshot::Builder builder ((ParseLimits()), (Retention()));
+	builder.addFolder ("News", 30, false);
+	builder.addFeed ("http://example.com/1", "One", "", Retention (-1, -1, -1), read1, 0);
+	builder.addFeed ("http://example.com/2", "Two", "latin1", Retention (7, -1, 0), read2);
+	std::string data;
+	builder.finish (&data);
+
+	gchar *path = g_build_filename (g_get_tmp_dir(), "eatfeed-check.snapshot", NULL);
+	std::string error;
+	CHECK (g_file_set_contents (path, data.data(), data.size(), NULL));
+	{
+		Snapshot snapshot;
+		CHECK (snapshot.map (path, error) && error.empty());
+		CHECK (snapshot.feedsNb() == 2 && snapshot.foldersNb() == 1);
+		if (snapshot.feedsNb() == 2 && snapshot.foldersNb() == 1) {
+			CHECK (!strcmp (snapshot.feedUrl (1), "http://example.com/2"));
+			CHECK (!strcmp (snapshot.feedCodeset (1), "latin1"));
+			CHECK (snapshot.feedRetention (1).max_days == 7);
+			CHECK (snapshot.feedFolder (0) == 0 && snapshot.feedFolder (1) == -1);
+			CHECK (!strcmp (snapshot.folderName (0), "News"));
+			CHECK (snapshot.folderRefresh (0) == 30 && !snapshot.folderExpanded (0));
+			IdSet read;
+			CHECK (snapshot.attachRead (0, &read));
+			CHECK (read.size() == 2 && read.contains (std::string ("b")));
+			CHECK (snapshot.attachRead (1, &read) && !read.size());
+		}
+	}
+
+	// cut short anywhere, it is refused rather than read in part
+	int wrong = 0;
+	for (size_t len = 0; len < data.size(); len += 8) {
+		g_file_set_contents (path, data.data(), len, NULL);
+		Snapshot snapshot;
+		error.clear();
+		if (snapshot.map (path, error) || error.empty())
+			wrong++;
+	}
+	CHECK (wrong == 0);
+	g_unlink (path);
+	g_free (path);
+}
+
+int main()
+{
+	check_dates();
+	check_json();
+	check_idset();
+	check_search();
+	check_canonical_links();
+	check_snapshot();
+	if (failures) {
+		printf ("%d checks failed\n", failures);
+		return 1;
+	}
+	printf ("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,251 @@
+// date.cpp
+
+#include "date.h"
+
+// calendar (see http://howardhinnant.github.io/date_algorithms.html)
+
+static gint64 days_from_civil (int year, int month, int day)
+{
+	year -= month <= 2;
+	int era = (year >= 0 ? year : year-399) / 400;
+	unsigned int yoe = year - era * 400;
+	unsigned int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day-1;
+	unsigned int doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+	return (gint64) era * 146097 + doe - 719468;
+}
+
+static void civil_from_days (gint64 days, int *year, int *month, int *day)
+{
+	days += 719468;
+	gint64 era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned int doe = days - era * 146097;
+	unsigned int yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+	unsigned int doy = doe - (365*yoe + yoe/4 - yoe/100);
+	unsigned int mp = (5*doy + 2) / 153;
+	*day = doy - (153*mp + 2)/5 + 1;
+	*month = mp < 10 ? mp+3 : mp-9;
+	*year = yoe + era * 400 + (*month <= 2);
+}
+
+static bool make_date (int year, int month, int day, int hour, int min, int sec,
+                       int zone, bool known_zone, Date *date)
+{
+	if ((unsigned) (month-1) > 11 || (unsigned) (day-1) > 30 ||
+	    (unsigned) hour > 23 || (unsigned) min > 59 || (unsigned) sec > 60)
+		return false;
+	date->time = days_from_civil (year, month, day) * 86400 +
+		hour * 3600 + min * 60 + sec - zone * 60;
+	date->zone = zone;
+	date->flags = Date::VALID | (known_zone ? Date::KNOWN_ZONE : 0);
+	return true;
+}
+
+// scanning
+
+// reads at most max digits; returns how many were read
+static inline int scan_digits (const char *&s, int max, int *value)
+{
+	int v = 0, n = 0;
+	for (unsigned int d; n < max && (d = s[n] - '0') < 10; n++)
+		v = v*10 + d;
+	s += n;
+	*value = v;
+	return n;
+}
+
+static inline void skip_spaces (const char *&s)
+{ while (*s == ' ' || *s == '\t') s++; }
+
+static inline bool is_alpha (char c)
+{ return (unsigned) ((c | 0x20) - 'a') < 26; }
+
+// up to three letters, case-folded, packed five bits each
+static inline int scan_word (const char *&s, int *len)
+{
+	int key = 0, n = 0;
+	for (; is_alpha (s[n]); n++)
+		if (n < 3)
+			key = key*32 + ((s[n] | 0x20) - 'a' + 1);
+	s += n;
+	*len = n;
+	return key;
+}
+
+static const char *months[] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+#define KEY(a,b,c) ((((a)-'a'+1)*32 + ((b)-'a'+1))*32 + ((c)-'a'+1))
+static const int month_keys[] = {
+	KEY('j','a','n'), KEY('f','e','b'), KEY('m','a','r'), KEY('a','p','r'),
+	KEY('m','a','y'), KEY('j','u','n'), KEY('j','u','l'), KEY('a','u','g'),
+	KEY('s','e','p'), KEY('o','c','t'), KEY('n','o','v'), KEY('d','e','c') };
+#undef KEY
+
+static int month_from_key (int key)
+{
+	int month = 0;
+	for (int i = 0; i < 12; i++)
+		month |= (month_keys[i] == key) * (i+1);
+	return month;
+}
+
+// every zone name of rfc 822 (plus UTC), placed by a perfect hash on
+// the packed name; military zones follow 822, even if 2822 advises
+// against trusting their sign
+struct Timezone {
+	const char *name;
+	int offset;
+};
+static const Timezone timezones[64] = {
+	{ "EDT", -240 }, { "A", -60 }, { "B", -120 }, { 0, 0 },
+	{ "C", -180 }, { "D", -240 }, { "E", -300 }, { "EST", -300 },
+	{ "F", -360 }, { "G", -420 }, { "H", -480 }, { 0, 0 },
+	{ "I", -540 }, { 0, 0 }, { "K", -600 }, { "GMT", 0 },
+	{ "L", -660 }, { "M", -720 }, { "N", 60 }, { 0, 0 },
+	{ "O", 120 }, { "P", 180 }, { "Q", 240 }, { "PDT", -420 },
+	{ "R", 300 }, { "S", 360 }, { "T", 420 }, { 0, 0 },
+	{ "U", 480 }, { "V", 540 }, { "PST", -480 }, { "W", 600 },
+	{ "X", 660 }, { "Y", 720 }, { 0, 0 }, { "Z", 0 },
+	{ 0, 0 }, { "UT", 0 }, { 0, 0 }, { 0, 0 },
+	{ "MDT", -360 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+	{ "UTC", 0 }, { 0, 0 }, { 0, 0 }, { "MST", -420 },
+	{ 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+	{ 0, 0 }, { 0, 0 }, { "CDT", -300 }, { 0, 0 },
+	{ 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+	{ 0, 0 }, { "CST", -360 }, { 0, 0 }, { 0, 0 },
+};
+
+static bool timezone_offset (const char *name, int len, int key, int *offset)
+{
+	if (len > 3)
+		return false;
+	const Timezone &tz = timezones [((key * 1381) & 0xffff) >> 10];
+	if (!tz.name || g_ascii_strncasecmp (tz.name, name, len) || tz.name[len])
+		return false;
+	*offset = tz.offset;
+	return true;
+}
+
+// numeric offset: "+0100", "-05:00"
+static bool scan_offset (const char *&s, int *offset)
+{
+	int sign = (*s == '-') ? -1 : 1, hour, min = 0;
+	s++;
+	if (scan_digits (s, 2, &hour) != 2)
+		return false;
+	if (*s == ':')
+		s++;
+	scan_digits (s, 2, &min);
+	*offset = sign * (hour * 60 + min);
+	return true;
+}
+
+bool parse_rfc822 (const char *s, Date *date)
+{
+	// spec: http://asg.web.cmu.edu/rfc/rfc822.html
+	// [day ","] DD Mon YY[YY] HH:MM[:SS] zone
+	int year, month, day, hour, min, sec = 0, zone = 0, len;
+	skip_spaces (s);
+	if (is_alpha (*s)) {
+		scan_word (s, &len);
+		if (*s == ',') s++;
+		skip_spaces (s);
+	}
+	if (!scan_digits (s, 2, &day))
+		return false;
+	skip_spaces (s);
+	if (*s == '-') s++;
+	month = month_from_key (scan_word (s, &len));
+	if (!month)
+		return false;
+	if (*s == '-') s++;
+	skip_spaces (s);
+	len = scan_digits (s, 4, &year);
+	if (len == 2)
+		year += year < 50 ? 2000 : 1900;
+	else if (len != 4)
+		return false;
+	skip_spaces (s);
+	if (scan_digits (s, 2, &hour) == 0 || *s++ != ':' || scan_digits (s, 2, &min) != 2)
+		return false;
+	if (*s == ':') {
+		s++;
+		scan_digits (s, 2, &sec);
+	}
+	skip_spaces (s);
+
+	bool known_zone = true;
+	if (*s == '+' || *s == '-')
+		known_zone = scan_offset (s, &zone);
+	else {
+		const char *name = s;
+		int key = scan_word (s, &len);
+		known_zone = timezone_offset (name, len, key, &zone);
+	}
+	if (!known_zone)
+		zone = 0;
+	return make_date (year, month, day, hour, min, sec, zone, known_zone, date);
+}
+
+bool parse_rfc3339 (const char *s, Date *date)  // Atom
+{
+	// spec: http://tools.ietf.org/html/rfc3339#section-5.6
+	// YYYY-MM-DDTHH:MM:SS[.frac](Z|+HH:MM)
+	int year, month, day, hour = 0, min = 0, sec = 0, zone = 0;
+	skip_spaces (s);
+	if (scan_digits (s, 4, &year) != 4 || *s++ != '-' ||
+	    scan_digits (s, 2, &month) != 2 || *s++ != '-' ||
+	    scan_digits (s, 2, &day) != 2)
+		return false;
+	bool known_zone = false;
+	if (*s == 'T' || *s == 't' || *s == ' ') {
+		s++;
+		if (scan_digits (s, 2, &hour) != 2 || *s++ != ':' ||
+		    scan_digits (s, 2, &min) != 2)
+			return false;
+		if (*s == ':') {
+			s++;
+			scan_digits (s, 2, &sec);
+		}
+		if (*s == '.')  // time-secfrac
+			do s++; while ((unsigned) (*s - '0') < 10);
+		if (*s == 'Z' || *s == 'z')
+			known_zone = true;
+		else if (*s == '+' || *s == '-')
+			known_zone = scan_offset (s, &zone);
+		if (!known_zone)
+			zone = 0;
+	}
+	return make_date (year, month, day, hour, min, sec, zone, known_zone, date);
+}
+
+// display
+
+std::string format_date (const Date &date)
+{
+	if (!date.valid())
+		return "";
+	gint64 local = date.time + date.zone * 60;
+	gint64 days = local / 86400, secs = local % 86400;
+	if (secs < 0) {
+		secs += 86400;
+		days--;
+	}
+	int year, month, day, hour = secs / 3600, min = (secs / 60) % 60;
+	civil_from_days (days, &year, &month, &day);
+
+	gchar *str;
+	if (!(date.flags & Date::KNOWN_ZONE))
+		str = g_strdup_printf ("%s %2d, %d (%02d:%02d ----)",
+			months[month-1], day, year, hour, min);
+	else {
+		int zone = date.zone < 0 ? -date.zone : date.zone;
+		str = g_strdup_printf ("%s %2d, %d (%02d:%02d %c%02d:%02d)",
+			months[month-1], day, year, hour, min, date.zone < 0 ? '-' : '+',
+			zone / 60, zone % 60);
+	}
+	std::string s (str);
+	g_free (str);
+	return s;
+}
@@ -0,0 +1,33 @@
+// date.h
+// feed dates, kept as utc timestamps so they can be compared
+
+#ifndef DATE_H
+#define DATE_H
+
+#include <glib.h>
+#include <string>
+
+struct Date
+{
+	gint64 time;  // seconds since the epoch, utc
+	gint16 zone;  // offset of the time as written in the feed, in minutes
+	guint8 flags;
+	enum { VALID = 1, KNOWN_ZONE = 2 };
+
+	Date() : time (0), zone (0), flags (0) {}
+
+	bool valid() const { return flags & VALID; }
+	bool operator == (const Date &d) const
+	{ return time == d.time && zone == d.zone && flags == d.flags; }
+	bool operator != (const Date &d) const { return !(*this == d); }
+	bool operator < (const Date &d) const { return time < d.time; }
+};
+
+// return false (and leave date untouched) if text can't be understood
+bool parse_rfc822 (const char *text, Date *date);   // RSS
+bool parse_rfc3339 (const char *text, Date *date);  // Atom
+
+// for display, e.g. "Jan  5, 2009 (13:04 +01:00)"; empty if not valid
+std::string format_date (const Date &date);
+
+#endif /*DATE_H*/
@@ -0,0 +1,212 @@
+// dedup.cpp
+
+#include "dedup.h"
+#include "idset.h"
+#include "search.h"
+#include <string.h>
+
+#define MIN_SLOTS 64
+#define MIN_WORDS 8      // for the text to be compared
+#define MAX_DISTANCE 3   // differing bits of near duplicates
+#define BANDS 4          // so at least one of 16 bits is the same
+
+// tracking arguments are noise
+static bool tracking (const std::string &param)
+{
+	return !param.compare (0, 4, "utm_") || !param.compare (0, 7, "fbclid=") ||
+		!param.compare (0, 6, "gclid=");
+}
+
+std::string DupIndex::canonicalLink (const std::string &link)
+{
+	std::string::size_type i = link.find ("://");
+	if (i == std::string::npos)
+		return link;
+	std::string scheme (link, 0, i);
+	for (unsigned int c = 0; c < scheme.size(); c++)
+		scheme[c] = g_ascii_tolower (scheme[c]);
+	std::string default_port (scheme == "https" ? ":443" : scheme == "http" ? ":80" : "");
+	if (scheme == "https")  // the same article either way
+		scheme = "http";
+
+	std::string::size_type host_end = link.find_first_of ("/?#", i + 3);
+	if (host_end == std::string::npos)
+		host_end = link.size();
+	std::string host (link, i + 3, host_end - i - 3);
+	for (unsigned int c = 0; c < host.size(); c++)
+		host[c] = g_ascii_tolower (host[c]);
+	if (!host.compare (0, 4, "www."))
+		host.erase (0, 4);
+	std::string::size_type port = host.rfind (':');
+	if (port != std::string::npos && !default_port.empty() &&
+	    !host.compare (port, std::string::npos, default_port))
+		host.erase (port);
+
+	std::string rest (link, host_end, link.find ('#', host_end) - host_end);
+	std::string::size_type q = rest.find ('?');
+	std::string path (rest, 0, q), query;
+	while (!path.empty() && path[path.size()-1] == '/')
+		path.erase (path.size()-1);
+	if (q != std::string::npos) {
+		std::string::size_type start = q + 1, end;
+		do {
+			end = rest.find ('&', start);
+			std::string param (rest, start, end - start);
+			if (!param.empty() && !tracking (param))
+				query += (query.empty() ? "?" : "&") + param;
+			start = end + 1;
+		} while (end != std::string::npos);
+	}
+	return scheme + "://" + host + path + query;
+}
+
+DupIndex::Fingerprint DupIndex::fingerprint (const std::string &link, const std::string &text)
+{
+	Fingerprint fp;
+	if (!link.empty())
+		fp.link = IdSet::hash (canonicalLink (link));
+
+	// SimHash: each bit is the vote of the words' hashes
+	std::vector <std::string> words;
+	SearchIndex::split (text, &words);
+	if (words.size() >= MIN_WORDS) {
+		int votes[64];
+		memset (votes, 0, sizeof (votes));
+		for (std::vector <std::string>::const_iterator it = words.begin(); it != words.end(); it++) {
+			guint64 h = IdSet::hash (*it);
+			for (int b = 0; b < 64; b++)
+				votes[b] += (h >> b) & 1 ? 1 : -1;
+		}
+		for (int b = 0; b < 64; b++)
+			if (votes[b] > 0)
+				fp.text |= G_GUINT64_CONSTANT (1) << b;
+		if (!fp.text)
+			fp.text = 1;
+	}
+	return fp;
+}
+
+static int distance (guint64 a, guint64 b)
+{
+	int bits = 0;
+	for (guint64 x = a ^ b; x; x &= x - 1)
+		bits++;
+	return bits;
+}
+
+static bool same (const DupIndex::Fingerprint &a, const DupIndex::Fingerprint &b)
+{
+	return (a.link && a.link == b.link) ||
+		(a.text && b.text && distance (a.text, b.text) <= MAX_DISTANCE);
+}
+
+DupIndex::DupIndex()
+: slots (MIN_SLOTS), mask (MIN_SLOTS - 1), count (0)
+{}
+
+int DupIndex::keys (const Fingerprint &fp, guint64 *keys)
+{
+	int n = 0;
+	if (fp.link)
+		keys[n++] = fp.link;
+	if (fp.text)
+		for (int b = 0; b < BANDS; b++) {
+			guint64 band = ((fp.text >> (b * 16)) & 0xffff) | ((guint64) (b + 1) << 16);
+			// mixed like IdSet::hash(), as the slot is taken from the low bits
+			band *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+			band ^= band >> 33;
+			keys[n++] = band ? band : 1;
+		}
+	return n;
+}
+
+gpointer DupIndex::find (const Fingerprint &fp, gconstpointer group) const
+{
+	guint64 k[1 + BANDS];
+	int n = keys (fp, k);
+	for (int i = 0; i < n; i++)
+		for (size_t j = k[i] & mask; slots[j].key; j = (j + 1) & mask) {
+			const Slot &slot = slots[j];
+			if (slot.key == k[i] && slot.group != group && same (slot.fp, fp))
+				return slot.data;
+		}
+	return NULL;
+}
+
+void DupIndex::insert (const Slot &slot)
+{
+	size_t j = slot.key & mask;
+	while (slots[j].key)
+		j = (j + 1) & mask;
+	slots[j] = slot;
+}
+
+void DupIndex::add (gpointer data, const Fingerprint &fp, gconstpointer group)
+{
+	guint64 k[1 + BANDS];
+	int n = keys (fp, k);
+	if ((count + n) * 2 > slots.size()) {
+		std::vector <Slot> old (slots.size() * 2);
+		old.swap (slots);
+		mask = slots.size() - 1;
+		for (unsigned int i = 0; i < old.size(); i++)
+			if (old[i].key)
+				insert (old[i]);
+	}
+	Slot slot;
+	slot.data = data;
+	slot.group = group;
+	slot.fp = fp;
+	for (int i = 0; i < n; i++) {
+		slot.key = k[i];
+		insert (slot);
+	}
+	count += n;
+}
+
+void DupIndex::erase (size_t i)
+{
+	// shift back the entries after it that would no longer be found
+	size_t j = i;
+	while (true) {
+		slots[i].key = 0;
+		while (true) {
+			j = (j + 1) & mask;
+			if (!slots[j].key)
+				break;
+			size_t home = slots[j].key & mask;
+			// move j into the hole unless its home lies cyclically in (i, j]
+			if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+				break;
+		}
+		if (!slots[j].key)
+			break;
+		slots[i] = slots[j];
+		i = j;
+	}
+	count--;
+}
+
+void DupIndex::replace (gpointer data, gpointer with, const Fingerprint &fp)
+{
+	guint64 k[1 + BANDS];
+	int n = keys (fp, k);
+	for (int i = 0; i < n; i++)
+		for (size_t j = k[i] & mask; slots[j].key; j = (j + 1) & mask)
+			if (slots[j].key == k[i] && slots[j].data == data) {
+				slots[j].data = with;
+				break;
+			}
+}
+
+void DupIndex::remove (gpointer data, const Fingerprint &fp)
+{
+	guint64 k[1 + BANDS];
+	int n = keys (fp, k);
+	for (int i = 0; i < n; i++)
+		for (size_t j = k[i] & mask; slots[j].key; j = (j + 1) & mask)
+			if (slots[j].key == k[i] && slots[j].data == data) {
+				erase (j);
+				break;
+			}
+}
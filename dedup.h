@@ -0,0 +1,47 @@
+// dedup.h
+// finds the news that some other feed already carries: same link once
+// canonicalised, or nearly the same text (by SimHash)
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <glib.h>
+#include <string>
+#include <vector>
+
+class DupIndex
+{
+public:
+	struct Fingerprint {
+		guint64 link, text;  // 0 when there isn't enough to go by
+		Fingerprint() : link (0), text (0) {}
+	};
+	// thread-safe, so it can be done by the parser
+	static Fingerprint fingerprint (const std::string &link, const std::string &text);
+	static std::string canonicalLink (const std::string &link);
+
+	DupIndex();
+
+	// an item of another group that this one duplicates, or NULL
+	gpointer find (const Fingerprint &fp, gconstpointer group) const;
+	void add (gpointer data, const Fingerprint &fp, gconstpointer group);
+	void remove (gpointer data, const Fingerprint &fp);
+	void replace (gpointer data, gpointer with, const Fingerprint &fp);
+
+private:
+	// a multimap: an item is under its link and each of its text bands
+	struct Slot {
+		guint64 key;  // 0 for an empty slot
+		gpointer data;
+		gconstpointer group;
+		Fingerprint fp;
+	};
+	std::vector <Slot> slots;
+	size_t mask, count;
+
+	static int keys (const Fingerprint &fp, guint64 *keys);
+	void insert (const Slot &slot);
+	void erase (size_t i);
+};
+
+#endif /*DEDUP_H*/
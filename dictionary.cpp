@@ -0,0 +1,46 @@
+// dictionary.cpp
+
+#include "dictionary.h"
+
+Dictionary::Dictionary()
+: names (1)
+{ g_static_mutex_init (&mutex); }
+
+Dictionary::~Dictionary()
+{ g_static_mutex_free (&mutex); }
+
+guint32 Dictionary::intern (const char *name, size_t len)
+{
+	if (!len)
+		return 0;
+	std::string key (name, len);
+	g_static_mutex_lock (&mutex);
+	std::map <std::string, guint32>::iterator it = ids.find (key);
+	guint32 id;
+	if (it != ids.end())
+		id = it->second;
+	else {
+		id = names.size();
+		names.push_back (key);
+		ids[key] = id;
+	}
+	g_static_mutex_unlock (&mutex);
+	return id;
+}
+
+guint32 Dictionary::find (const std::string &name) const
+{
+	g_static_mutex_lock (&mutex);
+	std::map <std::string, guint32>::const_iterator it = ids.find (name);
+	guint32 id = it != ids.end() ? it->second : 0;
+	g_static_mutex_unlock (&mutex);
+	return id;
+}
+
+const std::string &Dictionary::name (guint32 id) const
+{
+	g_static_mutex_lock (&mutex);
+	const std::string &str = id < names.size() ? names[id] : names[0];
+	g_static_mutex_unlock (&mutex);
+	return str;
+}
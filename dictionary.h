@@ -0,0 +1,30 @@
+// dictionary.h
+// interned names (of authors, categories, sites), so news keep small ids
+
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <glib.h>
+#include <deque>
+#include <map>
+#include <string>
+
+class Dictionary
+{
+public:
+	Dictionary();
+	~Dictionary();
+
+	// thread-safe; 0 is the empty name
+	guint32 intern (const char *name, size_t len);
+	guint32 intern (const std::string &name) { return intern (name.data(), name.size()); }
+	guint32 find (const std::string &name) const;  // 0 if unknown
+	const std::string &name (guint32 id) const;
+
+private:
+	std::map <std::string, guint32> ids;
+	std::deque <std::string> names;  // by id; they don't move as it grows
+	mutable GStaticMutex mutex;
+};
+
+#endif /*DICTIONARY_H*/
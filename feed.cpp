@@ -4,12 +4,31 @@
 #include <gdk/gdk.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <algorithm>
+#include <glib/gstdio.h>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <map>
+#include <new>
 
-// in minutes
+// in minutes; folders may have their own
 #define REFRESH_INTERVAL 30
+// in seconds; refreshes finishing meanwhile are written together
+#define STORE_DELAY 5
+// in milliseconds; changes made meanwhile are synced together
+#define JOURNAL_DELAY 500
+// in bytes; the config is saved again past it
+#define JOURNAL_MAX (256*1024)
+// in milliseconds; listeners are told of changes at most this often
+#define FRAME_DELAY 20
+// the config as last saved; ~/.eatfeed is only for import and export
+#define STATE_FILE ".eatfeed.d/state"
+// the config's limits and retention rules are ignored beyond these
+#define MAX_SIZE_LIMIT (1 << 20)  // in KB
+#define MAX_DEPTH_LIMIT 1000
+#define MAX_COUNT_LIMIT 1000000
 
 // utilities
 
@@ -19,6 +38,21 @@ static std::string prefix_homedir (const char *dir)
 	return str + "/" + dir;
 }
 
+// a whole number of the config, if it is one within [min, max]; else
+// value is left alone
+static bool config_number (const char *text, guint64 min, guint64 max, guint64 *value)
+{
+	if (!g_ascii_isdigit (*text))  // no sign nor blanks
+		return false;
+	gchar *end;
+	errno = 0;
+	guint64 n = g_ascii_strtoull (text, &end, 10);
+	if (*end || errno || n < min || n > max)
+		return false;
+	*value = n;
+	return true;
+}
+
 void replace (std::string &str, char dead, char live)
 {
 	// if we ever need to accept more characters make it accept a pair like
@@ -30,59 +64,171 @@ void replace (std::string &str, char dead, char live)
 
 // News
 
-News::News (Feed *feed)
-: feed (feed), is_read (false)
+News::News (Feed *feed, Arena *arena)
+: feed (feed), arena (arena), _author (0), site (0), _categories (NULL), categories_nb (0), pos (0),
+  is_read (false), doc (0), deduped (false),
+  original (NULL), next_copy (NULL)
+{
+}
+
+News::~News()
+{
+	if (doc)
+		Manager::get()->unindexNews (this);
+	if (deduped)
+		Manager::get()->undupNews (this);
+}
+
+News *News::create (Feed *feed, Arena *arena)
+{
+	arena->ref();
+	return new (arena->alloc (sizeof (News))) News (feed, arena);
+}
+
+void News::destroy (News *news)
 {
+	// the memory goes with the arena, once none of its news is left
+	Arena *arena = news->arena;
+	news->~News();
+	arena->unref();
+}
+
+News *News::moveTo (Arena *to)
+{
+	News *n = create (feed, to);
+	n->_title = to->copy (_title.c_str(), _title.size());
+	n->_summary = to->copy (_summary.c_str(), _summary.size());
+	n->_link = to->copy (_link.c_str(), _link.size());
+	n->title_key = to->copy (title_key.c_str(), title_key.size());
+	n->id = to->copy (id.c_str(), id.size());
+	n->updateId = to->copy (updateId.c_str(), updateId.size());
+	n->_date = _date;
+	n->_updateDate = _updateDate;
+	n->_author = _author;
+	n->site = site;
+	if (categories_nb) {
+		n->_categories = (guint32 *) to->alloc (categories_nb * sizeof (guint32));
+		memcpy (n->_categories, _categories, categories_nb * sizeof (guint32));
+		n->categories_nb = categories_nb;
+	}
+	n->pos = pos;
+	n->is_read = is_read;
+	n->fp = fp;
+	Manager::get()->handOver (this, n);
+	return n;
 }
 
 void News::setRead (bool read)
+{
+	for (News *n = original ? original : this; n; n = n->next_copy)
+		n->markRead (read);
+}
+
+Dictionary News::authors, News::categories_dict, News::sites;
+
+void News::complete()
+{
+	std::string link (_link.str());
+	fp = DupIndex::fingerprint (link, _title.str() + " " + _summary.str());
+	// as canonical, the host has no "www." nor case to tell apart
+	std::string canonical (DupIndex::canonicalLink (link));
+	std::string::size_type host = canonical.find ("://");
+	if (host != std::string::npos) {
+		host += 3;
+		site = sites.intern (canonical.substr (host, canonical.find_first_of ("/?", host) - host));
+	}
+	title_key = arena->copy (filter_key (_title.c_str(), _title.size()));
+}
+
+std::string News::categories() const
+{
+	std::string str;
+	for (guint32 i = 0; i < categories_nb; i++) {
+		if (i)
+			str += ", ";
+		str += categories_dict.name (_categories[i]);
+	}
+	return str;
+}
+
+void News::markRead (bool read)
 {
 	if (is_read != read) {
 		is_read = read;
+		if (!isCopy())
+			feed->addUnread (read ? -1 : 1);
+		feed->indexUnread (this);
 		feed->newsStatusChanged (this);
+		guint64 hash = IdSet::hash (id.c_str(), id.size());
 		if (read)
-			feed->read_news.push_back (id);
+			feed->read_news.insert (hash);
 		else
-			feed->read_news.remove (id);
+			feed->read_news.remove (hash);
 	}
 }
 
-static const std::string empty_str;
+static const Date empty_date;
 
-const std::string &News::updateDate() const
-{ return _date == _updateDate ? empty_str : _updateDate; }
+// news are known by their id, or their link when they have none
+const Text &News::key() const
+{ return id.empty() ? _link : id; }
+
+guint64 News::keyHash() const
+{ return IdSet::hash (key().c_str(), key().size()); }
+
+const Date &News::updateDate() const
+{ return _date == _updateDate ? empty_date : _updateDate; }
 
 void News::setTitle (const std::string &str)
-{ _title = str; }
+{ _title = arena->copy (str); }
 void News::setSummary (const std::string &str)  // content overloads summary
-{ if (_summary.empty()) _summary = str; }
+{ if (_summary.empty()) _summary = arena->copy (str); }
 void News::setContent (const std::string &str)
-{ _summary = str; }
+{ _summary = arena->copy (str); }
 void News::setLink (const std::string &str)
-{ _link = str; }
-void News::setDate (const std::string &str)
-{ _date = str; }
-void News::setUpdateDate (const std::string &date, const std::string &id)
-{ _updateDate = date; updateId = id; }
+{ _link = arena->copy (str); }
+void News::setDate (const Date &date)
+{ _date = date; }
+void News::setUpdateDate (const Date &date, const std::string &id)
+{ _updateDate = date; updateId = arena->copy (id); }
 void News::setAuthor (const std::string &str)
-{ _author = str; }
+{ _author = authors.intern (str); }
 void News::addCategory (const std::string &str)
-{ if (!_categories.empty()) _categories += ", "; _categories += str; }
+{
+	guint32 category = categories_dict.intern (str);
+	if (!category)
+		return;
+	for (guint32 i = 0; i < categories_nb; i++)
+		if (_categories[i] == category)
+			return;
+	// the old array stays in the arena; categories are few
+	guint32 *ids = (guint32 *) arena->alloc ((categories_nb + 1) * sizeof (guint32));
+	memcpy (ids, _categories, categories_nb * sizeof (guint32));
+	ids [categories_nb++] = category;
+	_categories = ids;
+}
 void News::setId (const std::string &str)
 {
-	id = str;  // check if already read
-	if (std::find (feed->read_news.begin(), feed->read_news.end(), id) != feed->read_news.end())
-		is_read = true;
-	if (_link.empty() && str.compare (0, 7, "http://") == 0)
-		_link = str;
+	id = arena->copy (str);
+	identify();
+}
+
+// may be on the parse thread: whether it was read is up to the feed, on
+// the ui one (see Feed::wasRead())
+void News::identify()
+{
+	if (_link.empty() && !strncmp (id.c_str(), "http://", 7))
+		_link = id;
 }
 
 // Feed
 
 Feed::Feed (const std::string &_url, const std::string &title,
             const std::string &codeset)
-: url (_url), _title (title), codeset (codeset), _loading (false), _iconPixbuf (NULL)
+: url (_url), _title (title), codeset (codeset), fetched_arena (NULL), retention (-1, -1, -1),
+  unread (0), pos (0), _folder (NULL), _loading (false), _iconPixbuf (NULL)
 {
+	setKey();
 }
 
 Feed::~Feed()
@@ -94,9 +240,72 @@ Feed::~Feed()
 void Feed::clear()
 {
 	for (std::vector <News *>::iterator it = news.begin(); it != news.end(); it++)
-		delete *it;
+		News::destroy (*it);
+	for (std::vector <News *>::iterator it = fetched.begin(); it != fetched.end(); it++)
+		News::destroy (*it);
 	news.clear();
+	fetched.clear();
+	by_date.clear();
 	error_msg.clear();
+	unread_pos.clear();
+	addUnread (-unread);
+}
+
+static bool same_fingerprint (const DupIndex::Fingerprint &a, const DupIndex::Fingerprint &b)
+{ return a.link == b.link && a.text == b.text; }
+
+void Feed::merge()
+{
+	// the fetched news are the latest; keep the older ones that are no
+	// longer in the feed, as long as the retention rules allow
+	std::map <std::string, News *> keys;
+	for (std::vector <News *>::const_iterator it = fetched.begin(); it != fetched.end(); it++) {
+		keys[(*it)->key().str()] = *it;
+		(*it)->is_read = wasRead (*it);
+	}
+	Retention keep = retention.over (Manager::get()->retention);
+	gint64 oldest = keep.max_days ? time (NULL) - keep.max_days * (gint64) 86400 : 0;
+	// those kept are copied over to the fetched ones' arena, so that the
+	// older arenas all go now, rather than each be held by a few news
+	Arena *arena;
+	if (fetched.empty())
+		arena = new Arena();
+	else {
+		arena = fetched[0]->arena;
+		arena->ref();
+	}
+	for (std::vector <News *>::iterator it = news.begin(); it != news.end(); it++) {
+		const Text &key = (*it)->key();
+		std::map <std::string, News *>::iterator fresh = keys.find (key.str());
+		if (fresh != keys.end()) {
+			News *heir = fresh->second;
+			heir->is_read = (*it)->is_read;  // may have been toggled during the refresh
+			// unchanged, it keeps its place in the indexes; else it is as new
+			if (!heir->doc && !heir->deduped && same_fingerprint (heir->fp, (*it)->fp))
+				Manager::get()->handOver (*it, heir);
+		}
+		const Date &date = (*it)->_date.valid() ? (*it)->_date : (*it)->_updateDate;
+		bool expired = ((keep.max_items && fetched.size() >= (unsigned) keep.max_items) ||
+			(date.valid() && date.time < oldest)) && !(keep.keep_unread && !(*it)->is_read);
+		if (!key.empty() && fresh == keys.end() && !expired)
+			fetched.push_back ((*it)->moveTo (arena));
+		News::destroy (*it);
+	}
+	arena->unref();
+	news.swap (fetched);
+	fetched.clear();
+	recount();
+
+	// we don't want to keep stored the washed up old flags
+	read_news.clear();
+	for (std::vector <News *>::const_iterator it = news.begin(); it != news.end(); it++)
+		if ((*it)->isRead())
+			read_news.insert (IdSet::hash ((*it)->id.c_str(), (*it)->id.size()));
+}
+
+bool Feed::wasRead (const News *news) const
+{
+	return read_news.contains (IdSet::hash (news->id.c_str(), news->id.size()));
 }
 
 News *Feed::getNews (int nb) const
@@ -108,47 +317,113 @@ News *Feed::getNews (int nb) const
 
 int Feed::getNewsNb (News *n) const
 {
-	for (unsigned int i = 0; i < news.size(); i++)
-		if (news[i] == n)
-			return i;
+	if (n->pos < news.size() && news[n->pos] == n)
+		return n->pos;
 	return 0;
 }
 
+void Feed::addUnread (int delta)
+{
+	bool had = unread > 0;
+	unread += delta;
+	if (_folder)
+		_folder->unread += delta;
+	Manager *manager = Manager::get();
+	manager->unread += delta;
+	// unless it is no longer the manager's
+	if (had != (unread > 0) && manager->getFeed (pos) == this) {
+		if (unread)
+			manager->unread_feeds.insert (pos);
+		else
+			manager->unread_feeds.erase (pos);
+	}
+}
+
+void Feed::indexUnread (News *news)
+{
+	if (!news->is_read && !news->isCopy())
+		unread_pos.insert (news->pos);
+	else
+		unread_pos.erase (news->pos);
+}
+
+int Feed::nextUnread (int nb, bool backwards) const
+{
+	if (!backwards) {
+		std::set <int>::const_iterator it = unread_pos.upper_bound (nb);
+		return it != unread_pos.end() ? *it : -1;
+	}
+	std::set <int>::const_iterator it = unread_pos.lower_bound (nb < 0 ? news.size() : nb);
+	return it != unread_pos.begin() ? *--it : -1;
+}
+
+// by date, or update if it has none; undated ones last
+static gint64 news_time (const News *news)
+{
+	const Date &date = news->date().valid() ? news->date() : news->updateDate();
+	return date.valid() ? date.time : G_MININT64;
+}
+
+static bool newer_news (const News *a, const News *b)
+{ return news_time (a) > news_time (b); }
+
+void Feed::recount()
+{
+	unread_pos.clear();
+	for (unsigned int i = 0; i < news.size(); i++) {
+		news[i]->pos = i;
+		if (!news[i]->isRead() && !news[i]->isCopy())
+			unread_pos.insert (unread_pos.end(), i);
+	}
+	addUnread ((int) unread_pos.size() - unread);
+	by_date = news;
+	std::stable_sort (by_date.begin(), by_date.end(), newer_news);
+}
+
 gpointer Feed::parse_thread_cb (gpointer data)
 {
 	Feed *pThis = (Feed *) data;
 	std::string error;
-	parse (pThis, pThis->url, pThis->codeset, error);
-
-	pThis->_loading = false;
-	pThis->error_msg = error;
-	if (error.empty()) {
-		// we don't want to keep stored the washed up old flags
-		pThis->read_news.clear();
-		for (std::vector <News *>::const_iterator it = pThis->news.begin();
-		     it != pThis->news.end(); it++) {
-			if ((*it)->isRead())
-				pThis->read_news.push_back ((*it)->id);
-		}
-		// icon is not loaded concurrently because it requires link from xml
-		if (!pThis->_iconPixbuf)
-			pThis->loadIcon();
+	parse (pThis, pThis->url, pThis->codeset, Manager::get()->parseLimits(), error);
+	if (pThis->fetched_arena) {  // the news hold it now
+		pThis->fetched_arena->unref();
+		pThis->fetched_arena = NULL;
 	}
+	for (std::vector <News *>::iterator it = pThis->fetched.begin();
+	     it != pThis->fetched.end(); it++)
+		(*it)->complete();
+
+	// icon is not loaded concurrently because it requires link from xml
+	if (error.empty() && !pThis->_iconPixbuf)
+		pThis->loadIcon();
 
 	gdk_threads_enter();
-	Manager::get()->feedLoaded (pThis);
-	gdk_flush();
+	pThis->fetch_error = error;
+	Manager::get()->feedParsed (pThis);
 	gdk_threads_leave();
 	return 0;
 }
 
+void Feed::loaded()
+{
+	// the cached news were shown meanwhile; swap them now the ui is ours
+	_loading = false;
+	error_msg = fetch_error;
+	if (error_msg.empty())
+		merge();
+	else {
+		for (std::vector <News *>::iterator it = fetched.begin(); it != fetched.end(); it++)
+			News::destroy (*it);
+		fetched.clear();
+	}
+}
+
 void Feed::refresh()
 {
 	if (!_loading) {
 		_loading = true;
 		error_msg.clear();
 		Manager::get()->feedLoading (this);
-		clear();
 
 		GError *error;
 		GThread *thread = g_thread_create_full (parse_thread_cb, this, 0, FALSE, FALSE,
@@ -160,23 +435,63 @@ void Feed::refresh()
 
 void Feed::newsStatusChanged (News *news)
 {
+	Manager::get()->journalChange (news->is_read ? Journal::READ : Journal::UNREAD,
+		url, "", "", IdSet::hash (news->id.c_str(), news->id.size()));
 	Manager::get()->feedStatusChanged (this);
 }
 
-int Feed::unreadNb() const
+void Feed::markAllRead (gint64 before)
 {
-	int unread = 0;
-	for (std::vector <News *>::const_iterator it = news.begin(); it != news.end(); it++)
-		if (!(*it)->isRead())
-			unread++;
-	return unread;
+	std::string hashes;
+	int marked = 0;
+	for (std::vector <News *>::const_iterator it = news.begin(); it != news.end(); it++) {
+		if ((*it)->is_read)
+			continue;
+		if (before) {  // undated ones aren't known to be old
+			gint64 time = news_time (*it);
+			if (time == G_MININT64 || time >= before)
+				continue;
+		}
+		for (News *n = (*it)->original ? (*it)->original : *it; n; n = n->next_copy) {
+			if (n->is_read)
+				continue;
+			if (n->feed != this) {  // copies elsewhere are few: one by one
+				n->markRead (true);
+				continue;
+			}
+			n->is_read = true;
+			if (!n->isCopy())
+				marked++;
+			unread_pos.erase (n->pos);
+			guint64 hash = IdSet::hash (n->id.c_str(), n->id.size());
+			read_news.insert (hash);
+			hashes.append ((const char *) &hash, sizeof (hash));
+		}
+	}
+	if (hashes.empty())
+		return;
+	addUnread (-marked);
+	Manager::get()->journalChange (Journal::READ_MANY, url, hashes);
+	Manager::get()->feedStatusChanged (this);
 }
 
 void Feed::setUserTitle (const std::string &str)
-{ _title = str; }
+{
+	_title = str;
+	setKey();
+	Manager::get()->journalChange (Journal::RENAME, url, str);
+	Manager::get()->feedStatusChanged (this);
+}
 
 void Feed::setTitle (const std::string &str)
-{ if (_title.empty()) _title = str; _oriTitle = str; }
+{ if (_title.empty()) { _title = str; setKey(); } _oriTitle = str; }
+
+void Feed::setKey()
+{
+	const std::string &shown = _title.empty() ? url : _title;
+	title_key = filter_key (shown.c_str(), shown.size());
+}
+
 void Feed::setDescription (const std::string &str)
 { _description = str; }
 void Feed::setLink (const std::string &str)
@@ -192,7 +507,7 @@ void Feed::loadIcon()
 		static std::string get (const std::string &webpage)
 		{
 			std::string text, error;
-			text = download (webpage, error);
+			text = download (webpage, error, Manager::get()->parseLimits().max_body);
 			std::string::size_type i = 0;
 			while ((i = text.find ("<link", i+1)) != std::string::npos) {
 				std::string::size_type j = text.find ("rel=", i) + 5;
@@ -257,8 +572,11 @@ GdkPixbuf *Feed::loadPixbuf (const std::string &url)
 
 ParseNewsHandler *Feed::appendNews()
 {
-	News *n = new News (this);
-	news.push_back (n);
+	// all news of a refresh go in one arena
+	if (!fetched_arena)
+		fetched_arena = new Arena();
+	News *n = News::create (this, fetched_arena);
+	fetched.push_back (n);
 	return n;
 }
 
@@ -268,13 +586,13 @@ XmlParser::Handler *Feed::startElement (const char *name,
 {
 	if (!strcmp (name, "news")) {
 		const char *id = XmlParser::get_value ("id", attribute_names, attribute_values);
-		if (id)
-			read_news.push_back (id);
+		if (id)  // from older versions; they're now kept in the store
+			read_news.insert (id);
 	}
 	return NULL;
 }
 
-void Feed::saveConfig (std::ofstream &stream) const
+void Feed::saveConfig (std::ostream &stream) const
 {
 	std::string _url (url);  // what the HELL?
 	replace (_url, '&', '@');  // check Manager::startElement() for info
@@ -282,36 +600,154 @@ void Feed::saveConfig (std::ofstream &stream) const
 	stream << "\t<feed title=\"" << _title << "\" url=\"" << _url << "\"";
 	if (!codeset.empty())
 		stream << " codeset=\"" << codeset << "\"";
-	stream << ">\n";
-	// if news empty, then the site is down or the network is; save previous info
-	for (std::list <std::string>::const_iterator it = read_news.begin();
-	     it != read_news.end(); it++)
-		stream << "\t\t<news id=\"" << *it << "\"></news>\n";
-	stream << "\t</feed>\n";
+	if (retention.max_days >= 0)
+		stream << " keep_days=\"" << retention.max_days << "\"";
+	if (retention.max_items >= 0)
+		stream << " keep_items=\"" << retention.max_items << "\"";
+	if (retention.keep_unread >= 0)
+		stream << " keep_unread=\"" << retention.keep_unread << "\"";
+	stream << "></feed>\n";
+}
+
+// read flags as older versions kept them: in the store, by "read <url>"
+#define READ_KEY(url) ("read " + (url))
+
+void Feed::loadRead (Store *store)
+{
+	std::string data;
+	if (store->load (READ_KEY (url), &data))
+		read_news.load (data);
+}
+
+static void get_text (Store::Reader &reader, Arena *arena, Text *text)
+{
+	const char *str;
+	size_t len;
+	if (reader.getString (&str, &len))
+		*text = arena->copy (str, len);
 }
 
+static void put_text (Store::Writer &writer, const Text &text)
+{ writer.putString (text.c_str(), text.size()); }
+
+void Feed::loadNews (Store *store)
+{
+	std::string batch;
+	if (!store->load (url, &batch))
+		return;
+	Store::Reader reader (batch);
+	std::string title;
+	gint64 count;
+	reader.getString (&title);
+	reader.getString (&_description);
+	reader.getString (&_link);
+	reader.getString (&_author);
+	reader.getString (&_logo);
+	reader.getInt (&count);
+	if (!reader.ok())
+		return;
+	setTitle (title);
+	Arena *arena = new Arena();
+	for (gint64 i = 0; i < count; i++) {
+		News *n = News::create (this, arena);
+		get_text (reader, arena, &n->id);
+		get_text (reader, arena, &n->_title);
+		get_text (reader, arena, &n->_summary);
+		get_text (reader, arena, &n->_link);
+		const char *str;
+		size_t len;
+		if (reader.getString (&str, &len))
+			n->_author = News::authors.intern (str, len);
+		if (reader.getString (&str, &len)) {  // as "a, b"
+			std::string categories (str, len);
+			for (std::string::size_type i = 0, j; i < len; i = j + 2) {
+				j = categories.find (", ", i);
+				if (j == std::string::npos)
+					j = len;
+				n->addCategory (categories.substr (i, j - i));
+			}
+		}
+		get_text (reader, arena, &n->updateId);
+		reader.getDate (&n->_date);
+		reader.getDate (&n->_updateDate);
+		if (!reader.ok()) {
+			News::destroy (n);
+			break;
+		}
+		n->identify();
+		n->is_read = wasRead (n);
+		n->complete();
+		news.push_back (n);
+	}
+	arena->unref();
+	recount();
+}
+
+void Feed::saveNews (Store *store) const
+{
+	Store::Writer writer;
+	writer.putString (_oriTitle);
+	writer.putString (_description);
+	writer.putString (_link);
+	writer.putString (_author);
+	writer.putString (_logo);
+	writer.putInt (news.size());
+	for (std::vector <News *>::const_iterator it = news.begin(); it != news.end(); it++) {
+		const News *n = *it;
+		put_text (writer, n->id);
+		put_text (writer, n->_title);
+		put_text (writer, n->_summary);
+		put_text (writer, n->_link);
+		writer.putString (n->author());
+		writer.putString (n->categories());
+		put_text (writer, n->updateId);
+		writer.putDate (n->_date);
+		writer.putDate (n->_updateDate);
+	}
+	store->put (url, writer.data);
+}
+
+// Folder
+
+Folder::Folder (const std::string &name)
+: _name (name), unread (0), refresh (-1), _expanded (true), pos (0), first (0), count (0)
+{}
+
 // Manager
 
 Manager::Manager()
-: feeds_loading (0), feeds_loaded (0)
+: unread (0), store (new Store (prefix_homedir (".eatfeed.d"))), store_timeout_id (0),
+  journal (new Journal (prefix_homedir (".eatfeed.d"))), journal_timeout_id (0),
+  compact_thread (NULL), replaying (false), state (new Snapshot()), save_thread (NULL), saving (0), feeds_loading (0), feeds_loaded (0),
+  progressed (false), notify_timeout_id (0), minutes (0), config_folder (NULL)
 {
+	singleton = this;  // for the feeds it loads
 	loadConfig();
-	g_timeout_add_seconds_full (G_PRIORITY_LOW, REFRESH_INTERVAL*60,
-	                            refresh_timeout, this, NULL);
+	g_timeout_add_seconds_full (G_PRIORITY_LOW, 60, refresh_timeout, this, NULL);
 }
 
+Manager *Manager::singleton = 0;
+
 Manager *Manager::get()
 {
-	static Manager *singleton = 0;
-	if (!singleton) singleton = new Manager();
+	if (!singleton) new Manager();
 	return singleton;
 }
 
+// every minute: the feeds whose folder's interval is up
 gboolean Manager::refresh_timeout (gpointer data)
 {
 	Manager *pThis = (Manager *) data;
-	pThis->saveConfig();  // save sometimes to subsidize a crash
-	pThis->refreshAll();
+	int minutes = ++pThis->minutes;
+	if (minutes % REFRESH_INTERVAL == 0)
+		pThis->saveConfig (false);  // keep the journal short
+	for (std::vector <Feed *>::iterator it = pThis->feeds.begin(); it != pThis->feeds.end(); it++) {
+		int interval = (*it)->_folder ? (*it)->_folder->refresh : -1;
+		if (interval < 0)
+			interval = REFRESH_INTERVAL;
+		if (interval && minutes % interval == 0)
+			(*it)->refresh();
+	}
 	return TRUE;  // keep going
 }
 
@@ -323,22 +759,35 @@ Feed *Manager::addFeed (const std::string &url, const std::string &title,
 		_url[0] = 'h'; _url[1] = 't'; _url[2] = 't'; _url[3] = 'p';
 	}
 
-	notifyStartStructuralChange();
 	Feed *feed = new Feed (_url, title, codeset);
+	feed->pos = feeds.size();
 	feeds.push_back (feed);
-	notifyEndStructuralChange();
+	for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++)
+		(*it)->feedAdded (this, feed);
+	journalChange (Journal::ADD, _url, title, codeset);
 	return feed;
 }
 
 void Manager::removeFeed (Feed *feed)
 {
-	notifyStartStructuralChange();
-	std::vector <Feed *>::iterator it = std::find (feeds.begin(), feeds.end(), feed);
-	if (it != feeds.end()) {
-		feeds.erase (it);
+	int pos = getFeedNb (feed);
+	if (pos < (signed) feeds.size() && feeds[pos] == feed) {
+		feeds.erase (feeds.begin() + pos);
+		renumber (pos, feeds.size());
+		if (feed->_folder) {  // kept until deleted, as where it was
+			feed->_folder->count--;
+			placeFolders();
+		}
+		for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++)
+			(*it)->feedRemoved (this, feed, pos);
+		changed_feeds.erase (feed);
+		parsed_feeds.erase (std::remove (parsed_feeds.begin(), parsed_feeds.end(), feed),
+			parsed_feeds.end());
+		journalChange (Journal::REMOVE, feed->_url());
+		store->remove (feed->_url());
+		store->remove (READ_KEY (feed->_url()));
 		delete feed;
 	}
-	notifyEndStructuralChange();
 }
 
 #if 0
@@ -355,51 +804,183 @@ void Manager::swap (Feed *feed1, Feed *feed2)
 
 void Manager::move (Feed *feed, int pos)
 {
-	notifyStartStructuralChange();
-	std::vector <Feed *>::iterator it;
-	int i;
-	for (i = 0, it = feeds.begin(); it != feeds.end(); it++, i++)
-		if (*it == feed) {
-			feeds.erase (it);
-			if (i < pos)
-				pos--;
-			break;
-		}
-	for (i = 0, it = feeds.begin(); it != feeds.end(); it++, i++)
-		if (i == pos) {
-			feeds.insert (it, feed);
-			break;
-		}
-	if (it == feeds.end())
-		feeds.push_back (feed);
-	notifyEndStructuralChange();
+	int from = getFeedNb (feed);
+	if (from >= (signed) feeds.size() || feeds[from] != feed)
+		return;
+	feeds.erase (feeds.begin() + from);
+	if (from < pos)
+		pos--;
+	// within its folder, or below them all
+	Folder *folder = feed->_folder;
+	int first = folder ? folder->first : groupedNb();
+	int last = folder ? folder->first + folder->count - 1 : feeds.size();
+	if (pos < 0 || pos > last)
+		pos = last;
+	pos = MAX (pos, first);
+	feeds.insert (feeds.begin() + pos, feed);
+	renumber (MIN (from, pos), MAX (from, pos) + 1);
+	for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++)
+		(*it)->feedMoved (this, feed, from);
+	journalChange (Journal::MOVE, feed->_url(), "", "", getFeedNb (feed));
 }
 
-void Manager::notifyStartStructuralChange()
+Feed *Manager::getFeed (int nb) const
 {
+	if (nb < 0 || nb >= (signed) feeds.size())
+		return NULL;
+	return feeds[nb];
+}
+
+int Manager::getFeedNb (Feed *feed) const
+{
+	if (feed->pos < (signed) feeds.size() && feeds[feed->pos] == feed)
+		return feed->pos;
+	return 0;
+}
+
+// after feeds moved in [from, to); to the end, one may have gone
+void Manager::renumber (int from, int to)
+{
+	unread_feeds.erase (unread_feeds.lower_bound (from),
+		to < (signed) feeds.size() ? unread_feeds.lower_bound (to) : unread_feeds.end());
+	for (int i = from; i < to; i++) {
+		feeds[i]->pos = i;
+		if (feeds[i]->unread)
+			unread_feeds.insert (i);
+	}
+}
+
+Feed *Manager::nextUnreadFeed (int nb, bool backwards) const
+{
+	if (unread_feeds.empty())
+		return NULL;
+	std::set <int>::const_iterator it;
+	if (!backwards) {
+		it = unread_feeds.upper_bound (nb);
+		if (it == unread_feeds.end())
+			it = unread_feeds.begin();
+	}
+	else {
+		it = unread_feeds.lower_bound (nb < 0 ? feeds.size() : nb);
+		if (it == unread_feeds.begin())
+			it = unread_feeds.end();
+		--it;
+	}
+	return feeds[*it];
+}
+
+void Manager::placeFolders()
+{
+	int first = 0;
+	for (unsigned int i = 0; i < folders.size(); i++) {
+		folders[i]->pos = i;
+		folders[i]->first = first;
+		first += folders[i]->count;
+	}
+}
+
+int Manager::groupedNb() const
+{
+	if (folders.empty())
+		return 0;
+	return folders.back()->first + folders.back()->count;
+}
+
+Folder *Manager::getFolder (int nb) const
+{
+	if (nb < 0 || nb >= (signed) folders.size())
+		return NULL;
+	return folders[nb];
+}
+
+int Manager::getFolderNb (Folder *folder) const
+{
+	if (folder->pos < (signed) folders.size() && folders[folder->pos] == folder)
+		return folder->pos;
+	return -1;
+}
+
+Folder *Manager::findFolder (const std::string &name) const
+{
+	for (std::vector <Folder *>::const_iterator it = folders.begin(); it != folders.end(); it++)
+		if ((*it)->_name == name)
+			return *it;
+	return NULL;
+}
+
+Folder *Manager::addFolder (const std::string &name)
+{
+	Folder *folder = findFolder (name);
+	if (folder)
+		return folder;
+	folder = new Folder (name);
+	folders.push_back (folder);
+	placeFolders();
 	for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++)
-		(*it)->startStructuralChange (this);
+		(*it)->foldersChanged (this);
+	journalChange (Journal::FOLDER_ADD, "", name);
+	return folder;
 }
 
-void Manager::notifyEndStructuralChange()
+void Manager::removeFolder (Folder *folder)
 {
+	int nb = getFolderNb (folder);
+	if (nb < 0)
+		return;
+	// its feeds go, in their order, ahead of those at the top
+	int first = folder->first, count = folder->count, grouped = groupedNb();
+	std::rotate (feeds.begin() + first, feeds.begin() + first + count, feeds.begin() + grouped);
+	renumber (first, grouped);
+	for (int i = grouped - count; i < grouped; i++)
+		feeds[i]->_folder = NULL;
+	folders.erase (folders.begin() + nb);
+	placeFolders();
 	for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++)
-		(*it)->endStructuralChange (this);
+		(*it)->foldersChanged (this);
+	journalChange (Journal::FOLDER_REMOVE, "", folder->_name);
+	delete folder;
 }
 
-Feed *Manager::getFeed (int nb) const
+bool Manager::renameFolder (Folder *folder, const std::string &name)
 {
-	if (nb >= (signed) feeds.size())
-		return NULL;
-	return feeds[nb];
+	if (name.empty() || findFolder (name))
+		return false;
+	journalChange (Journal::FOLDER_RENAME, "", folder->_name, name);
+	folder->_name = name;
+	for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++)
+		(*it)->foldersChanged (this);
+	return true;
 }
 
-int Manager::getFeedNb (Feed *feed) const
+void Manager::setRefreshInterval (Folder *folder, int minutes)
 {
-	for (unsigned int i = 0; i < feeds.size(); i++)
-		if (feeds[i] == feed)
-			return i;
-	return 0;
+	folder->refresh = minutes;
+	journalChange (Journal::FOLDER_REFRESH, "", folder->_name, "", minutes);
+}
+
+void Manager::setFolder (Feed *feed, Folder *folder)
+{
+	int from = getFeedNb (feed);
+	if (feed->_folder == folder || from >= (signed) feeds.size() || feeds[from] != feed)
+		return;
+	feeds.erase (feeds.begin() + from);
+	if (feed->_folder) {
+		feed->_folder->count--;
+		feed->_folder->unread -= feed->unread;
+	}
+	placeFolders();
+	int to = folder ? folder->first + folder->count : feeds.size();
+	feeds.insert (feeds.begin() + to, feed);
+	feed->_folder = folder;
+	if (folder) {
+		folder->count++;
+		folder->unread += feed->unread;
+	}
+	placeFolders();
+	renumber (MIN (from, to), MAX (from, to) + 1);
+	for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++)
+		(*it)->foldersChanged (this);
+	journalChange (Journal::FILE, feed->url, folder ? folder->_name : "");
 }
 
 void Manager::refreshAll()
@@ -408,69 +989,308 @@ void Manager::refreshAll()
 		(*it)->refresh();
 }
 
-int Manager::unreadNb() const
+void Manager::markAllRead (Folder *folder, gint64 before)
 {
-	int unread = 0;
-	for (std::vector <Feed *>::const_iterator it = feeds.begin(); it != feeds.end(); it++)
-		unread += (*it)->unreadNb();
-	return unread;
+	int first = folder ? folder->first : 0;
+	int last = folder ? folder->first + folder->count : feeds.size();
+	for (int i = first; i < last; i++)
+		feeds[i]->markAllRead (before);
 }
 
 void Manager::feedStatusChanged (Feed *feed)
 {
-	for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++)
-		(*it)->feedStatusChange (this, feed);
+	changed_feeds.insert (feed);
+	notifyLater();
 }
 
 void Manager::feedLoading (Feed *feed)
 {
 	feeds_loading++;
-	for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++) {
-		(*it)->feedStatusChange (this, feed);
-		(*it)->feedLoading (this, feed);
-		if (feeds_loading > 1)
-			(*it)->feedsLoadingProgress (this, ((float) feeds_loaded) / feeds_loading);
-	}
+	progressed = true;
+	feedStatusChanged (feed);
 }
 
-void Manager::feedLoaded (Feed *feed)
+void Manager::feedParsed (Feed *feed)
 {
-	feeds_loaded++;
-	for (std::list <Listener *>::iterator it = listeners.begin(); it != listeners.end(); it++) {
-		(*it)->feedStatusChange (this, feed);
-		(*it)->feedLoaded (this, feed);
-		if (feeds_loading > 1)
-			(*it)->feedsLoadingProgress (this, ((float) feeds_loaded) / feeds_loading);
+	parsed_feeds.push_back (feed);
+	notifyLater();
+}
+
+// so that a burst of refreshes costs a redraw per frame, rather than per feed
+void Manager::notifyLater()
+{
+	if (!notify_timeout_id)
+		notify_timeout_id = gdk_threads_add_timeout_full (G_PRIORITY_DEFAULT, FRAME_DELAY,
+			notify_timeout, this, NULL);
+}
+
+gboolean Manager::notify_timeout (gpointer data)
+{
+	Manager *pThis = (Manager *) data;
+	pThis->notify_timeout_id = 0;
+
+	std::vector <Feed *> loaded;
+	loaded.swap (pThis->parsed_feeds);
+	for (std::vector <Feed *>::iterator it = loaded.begin(); it != loaded.end(); it++) {
+		Feed *feed = *it;
+		feed->loaded();
+		if (feed->errorMsg().empty()) {
+			pThis->storeFeed (feed);
+			pThis->indexFeed (feed);
+			pThis->dedupFeed (feed);
+		}
+		pThis->changed_feeds.insert (feed);
+		pThis->feeds_loaded++;
+		pThis->progressed = true;
+	}
+	std::vector <Feed *> changed (pThis->changed_feeds.begin(), pThis->changed_feeds.end());
+	pThis->changed_feeds.clear();
+
+	for (std::list <Listener *>::iterator it = pThis->listeners.begin();
+	     it != pThis->listeners.end(); it++) {
+		if (!changed.empty())
+			(*it)->feedsChanged (pThis, changed);
+		if (!loaded.empty())
+			(*it)->feedsLoaded (pThis, loaded);
+		if (pThis->progressed && pThis->feeds_loading > 1)
+			(*it)->feedsLoadingProgress (pThis,
+				((float) pThis->feeds_loaded) / pThis->feeds_loading);
 	}
-	if (feeds_loaded >= feeds_loading)
-		feeds_loading = (feeds_loaded = 0);
+	pThis->progressed = false;
+	if (pThis->feeds_loaded >= pThis->feeds_loading)
+		pThis->feeds_loading = (pThis->feeds_loaded = 0);
+	return FALSE;
+}
+
+// true if a was modified after b (or b doesn't exist)
+static bool newer (const std::string &a, const std::string &b)
+{
+	struct stat sa, sb;
+	if (g_stat (a.c_str(), &sa))
+		return false;
+	return g_stat (b.c_str(), &sb) || sa.st_mtime > sb.st_mtime;
 }
 
 void Manager::loadConfig()
 {
-	std::ifstream stream (prefix_homedir (".eatfeed").c_str());
-	if (stream.good()) {
-		XmlParser parser (this);
-		std::string error;
-		char buffer [4096];
-		while (stream.getline (buffer, 4096)) {
-			if (!parser.parse (buffer, error)) {
-				std::cout << "Error: couldn't parse .eatfeed: " << error << std::endl;
-				break;
-			}
+	replaying = true;  // nothing here goes to the journal
+	std::string error, xml = prefix_homedir (".eatfeed");
+	bool mapped = state->map (prefix_homedir (STATE_FILE), error);
+	if (!error.empty())
+		std::cout << "Error: " << error << std::endl;
+	if (mapped && !newer (xml, prefix_homedir (STATE_FILE))) {
+		state->getLimits (&limits);
+		state->getRetention (&retention);
+		for (int i = 0; i < state->foldersNb(); i++) {
+			Folder *folder = addFolder (state->folderName (i));
+			folder->refresh = state->folderRefresh (i);
+			folder->_expanded = state->folderExpanded (i);
+		}
+		for (int i = 0; i < state->feedsNb(); i++) {
+			Feed *feed = addFeed (state->feedUrl (i), state->feedTitle (i),
+			                      state->feedCodeset (i));
+			feed->retention = state->feedRetention (i);
+			if (!state->attachRead (i, &feed->read_news))
+				std::cout << "Error: the state snapshot has no read flags for "
+				          << feed->_url() << std::endl;
+			if (state->feedFolder (i) >= 0)
+				setFolder (feed, getFolder (state->feedFolder (i)));
+		}
+	}
+	else {  // edited by hand, or from an older version
+		importConfig (xml);
+		std::map <std::string, int> urls;
+		for (int i = 0; i < state->feedsNb(); i++)
+			urls[state->feedUrl (i)] = i;
+		for (std::vector <Feed *>::iterator it = feeds.begin(); it != feeds.end(); it++) {
+			std::map <std::string, int>::iterator i = urls.find ((*it)->_url());
+			if (i != urls.end() && !(*it)->read_news.size() &&  // may be legacy ones
+			    !state->attachRead (i->second, &(*it)->read_news))
+				std::cout << "Error: the state snapshot has no read flags for "
+				          << (*it)->_url() << std::endl;
+		}
+	}
+
+	// show what we had until the feeds are refreshed
+	error.clear();
+	if (store->open (error)) {
+		for (std::vector <Feed *>::iterator it = feeds.begin(); it != feeds.end(); it++) {
+			if (!mapped)
+				(*it)->loadRead (store);
+			else if (store->contains (READ_KEY ((*it)->_url())))  // in the state now
+				store->remove (READ_KEY ((*it)->_url()));
 		}
 	}
 	else
-		std::cout << "Error: couldn't open .eatfeed for reading.\n";
+		std::cout << "Error: couldn't open the news cache: " << error << std::endl;
+
+	// changes made after the config was last saved
+	std::vector <Journal::Entry> entries;
+	journal->replay (&entries);
+	for (std::vector <Journal::Entry>::const_iterator it = entries.begin();
+	     it != entries.end(); it++)
+		replay (*it);
+	if (!journal->open (error))
+		std::cout << "Error: couldn't open the journal: " << error << std::endl;
+
+	for (std::vector <Feed *>::iterator it = feeds.begin(); it != feeds.end(); it++) {
+		(*it)->loadNews (store);
+		indexFeed (*it);
+		dedupFeed (*it);
+	}
+	replaying = false;
+	if (!entries.empty())
+		saveConfig (true);
 	atexit (saveManager);
 }
 
+Feed *Manager::findFeed (const std::string &url) const
+{
+	for (std::vector <Feed *>::const_iterator it = feeds.begin(); it != feeds.end(); it++)
+		if ((*it)->_url() == url)
+			return *it;
+	return NULL;
+}
+
+void Manager::replay (const Journal::Entry &entry)
+{
+	if (entry.url.empty()) {  // of a folder
+		Folder *folder = findFolder (entry.text);
+		switch ((Journal::Op) entry.op) {
+			case Journal::FOLDER_ADD:
+				addFolder (entry.text);
+				break;
+			case Journal::FOLDER_REMOVE:
+				if (folder)
+					removeFolder (folder);
+				break;
+			case Journal::FOLDER_RENAME:
+				if (folder)
+					renameFolder (folder, entry.extra);
+				break;
+			case Journal::FOLDER_REFRESH:
+				if (folder)
+					setRefreshInterval (folder, entry.value);
+				break;
+			default: break;
+		}
+		return;
+	}
+	Feed *feed = findFeed (entry.url);
+	if (entry.op == Journal::ADD) {
+		if (!feed)
+			addFeed (entry.url, entry.text, entry.extra);
+		return;
+	}
+	if (!feed)
+		return;
+	switch ((Journal::Op) entry.op) {
+		case Journal::READ:
+			feed->read_news.insert (entry.value);
+			break;
+		case Journal::UNREAD:
+			feed->read_news.remove (entry.value);
+			break;
+		case Journal::READ_MANY:
+			for (size_t i = 0; i + sizeof (guint64) <= entry.text.size(); i += sizeof (guint64)) {
+				guint64 hash;
+				memcpy (&hash, entry.text.data() + i, sizeof (hash));
+				feed->read_news.insert (hash);
+			}
+			break;
+		case Journal::RENAME:
+			feed->setUserTitle (entry.text);
+			break;
+		case Journal::MOVE:
+			move (feed, entry.value);
+			break;
+		case Journal::REMOVE:
+			removeFeed (feed);
+			break;
+		case Journal::FILE:
+			setFolder (feed, entry.text.empty() ? NULL : findFolder (entry.text));
+			break;
+		default: break;
+	}
+}
+
+void Manager::journalChange (Journal::Op op, const std::string &url,
+	const std::string &text, const std::string &extra, gint64 value)
+{
+	if (replaying)
+		return;
+	Journal::Entry entry;
+	entry.op = op;
+	entry.url = url;
+	entry.text = text;
+	entry.extra = extra;
+	entry.value = value;
+	journal->append (entry);
+	if (!journal_timeout_id)
+		journal_timeout_id = g_timeout_add_full (G_PRIORITY_DEFAULT, JOURNAL_DELAY,
+			journal_timeout, this, NULL);
+}
+
+gboolean Manager::journal_timeout (gpointer data)
+{
+	Manager *pThis = (Manager *) data;
+	pThis->journal_timeout_id = 0;
+	std::string error;
+	if (!pThis->journal->flush (error))
+		std::cout << "Error: couldn't write the journal: " << error << std::endl;
+	if (pThis->journal->size() > JOURNAL_MAX)
+		pThis->saveConfig (false);
+	return FALSE;
+}
+
 XmlParser::Handler *Manager::startElement (const char *name,
 	const char **attribute_names, const char **attribute_values,
 	std::string &error)
 {
-	if (!strcmp (name, "feed")) {
+	if (!strcmp (name, "limits")) {
+		// no zeros: a limit isn't to be lifted by a slip
+		for (int i = 0; attribute_names[i]; i++) {
+			const char *attr = attribute_names[i], *text = attribute_values[i];
+			guint64 value;
+			if (!strcmp (attr, "body") && config_number (text, 1, MAX_SIZE_LIMIT, &value))
+				limits.max_body = value * 1024;
+			else if (!strcmp (attr, "depth") && config_number (text, 1, MAX_DEPTH_LIMIT, &value))
+				limits.max_depth = value;
+			else if (!strcmp (attr, "text") && config_number (text, 1, MAX_SIZE_LIMIT, &value))
+				limits.max_text = value * 1024;
+			else if (!strcmp (attr, "items") && config_number (text, 1, MAX_COUNT_LIMIT, &value))
+				limits.max_items = value;
+		}
+	}
+	else if (!strcmp (name, "retention")) {
+		// 0 for no limit
+		for (int i = 0; attribute_names[i]; i++) {
+			const char *attr = attribute_names[i], *text = attribute_values[i];
+			guint64 value;
+			if (!strcmp (attr, "days") && config_number (text, 0, MAX_COUNT_LIMIT, &value))
+				retention.max_days = value;
+			else if (!strcmp (attr, "items") && config_number (text, 0, MAX_COUNT_LIMIT, &value))
+				retention.max_items = value;
+			else if (!strcmp (attr, "unread") && config_number (text, 0, 1, &value))
+				retention.keep_unread = value;
+		}
+	}
+	else if (!strcmp (name, "folder")) {
+		const char *folder_name = XmlParser::get_value ("name", attribute_names, attribute_values);
+		if (folder_name && *folder_name) {
+			const char *refresh = XmlParser::get_value ("refresh", attribute_names, attribute_values);
+			const char *expanded = XmlParser::get_value ("expanded", attribute_names, attribute_values);
+			config_folder = addFolder (folder_name);
+			if (refresh)
+				config_folder->refresh = atoi (refresh);
+			if (expanded)
+				config_folder->_expanded = atoi (expanded);
+		}
+	}
+	else if (!strcmp (name, "feed")) {
 		const char *title = "", *url = 0, *codeset = "";
+		Retention keep (-1, -1, -1);  // those not given, or not right, are the global ones
+		guint64 value;
 		for (int i = 0; attribute_names[i]; i++) {
 			if (!strcmp (attribute_names[i], "title"))
 				title = attribute_values[i];
@@ -478,6 +1298,15 @@ XmlParser::Handler *Manager::startElement (const char *name,
 				url = attribute_values[i];
 			else if (!strcmp (attribute_names[i], "codeset"))
 				codeset = attribute_values[i];
+			else if (!strcmp (attribute_names[i], "keep_days") &&
+			         config_number (attribute_values[i], 0, MAX_COUNT_LIMIT, &value))
+				keep.max_days = value;
+			else if (!strcmp (attribute_names[i], "keep_items") &&
+			         config_number (attribute_values[i], 0, MAX_COUNT_LIMIT, &value))
+				keep.max_items = value;
+			else if (!strcmp (attribute_names[i], "keep_unread") &&
+			         config_number (attribute_values[i], 0, 1, &value))
+				keep.keep_unread = value;
 		}
 		if (url) {
 			// gtk xml parser has some adversity to chars on attributes like &
@@ -488,25 +1317,397 @@ XmlParser::Handler *Manager::startElement (const char *name,
 			replace (_url, '@', '&');
 
 			Feed *feed = addFeed (_url, title, codeset);
+			feed->retention = keep;
+			if (config_folder)
+				setFolder (feed, config_folder);
 			return feed;
 		}
 	}
 	return NULL;
 }
 
-void Manager::saveConfig() const
+void Manager::endElement (const char *name, XmlParser::Handler *child,
+	std::string &error)
 {
-	std::ofstream stream (prefix_homedir (".eatfeed").c_str());
-	if (stream.good()) {
-		stream << "<eatfeed>\n";
-		for (std::vector <Feed *>::const_iterator it = feeds.begin(); it != feeds.end(); it++)
-			(*it)->saveConfig (stream);
-		stream << "</eatfeed>\n";
+	if (!strcmp (name, "folder"))
+		config_folder = NULL;
+}
+
+void Manager::importConfig (const std::string &path)
+{
+	gchar *text;
+	gsize len;
+	if (g_file_get_contents (path.c_str(), &text, &len, NULL)) {
+		XmlParser parser (this);
+		std::string error;
+		if (!parser.parse (text, len, error))
+			std::cout << "Error: couldn't parse .eatfeed: " << error << std::endl;
+		g_free (text);
 	}
 	else
-		std::cout << "Error: couldn't open .eatfeed for saving.\n";
+		std::cout << "Error: couldn't open .eatfeed for reading.\n";
+}
+
+void Manager::exportConfig() const
+{
+	std::ostringstream stream;
+	stream << "<eatfeed>\n";
+	// sizes in KB
+	stream << "\t<limits body=\"" << limits.max_body / 1024 << "\" depth=\""
+	       << limits.max_depth << "\" text=\"" << limits.max_text / 1024
+	       << "\" items=\"" << limits.max_items << "\"></limits>\n";
+	stream << "\t<retention days=\"" << retention.max_days << "\" items=\""
+	       << retention.max_items << "\" unread=\"" << retention.keep_unread
+	       << "\"></retention>\n";
+	for (std::vector <Feed *>::const_iterator it = feeds.begin(); it != feeds.end(); it++) {
+		Folder *folder = (*it)->_folder;
+		if (folder && folder->first == (*it)->pos) {
+			gchar *name = g_markup_escape_text (folder->_name.c_str(), -1);
+			stream << "\t<folder name=\"" << name << "\" refresh=\"" << folder->refresh
+			       << "\" expanded=\"" << folder->_expanded << "\">\n";
+			g_free (name);
+		}
+		(*it)->saveConfig (stream);
+		if (folder && folder->first + folder->count == (*it)->pos + 1)
+			stream << "\t</folder>\n";
+	}
+	stream << "</eatfeed>\n";
+
+	std::string text = stream.str(), path = prefix_homedir (".eatfeed");
+	GError *error = NULL;
+	if (!g_file_set_contents (path.c_str(), text.data(), text.size(), &error)) {
+		std::cout << "Error: couldn't save .eatfeed: " << error->message << std::endl;
+		g_error_free (error);
+	}
+}
+
+void Manager::saveConfig (bool wait)
+{
+	// the state is captured here and written by a thread; the journal is
+	// started anew, and the old one dropped once the config is on disk
+	if (save_thread) {
+		if (!wait && g_atomic_int_get (&saving))
+			return;  // a save is still under way
+		g_thread_join (save_thread);
+		save_thread = NULL;
+	}
+	Snapshot::Builder builder (limits, retention);
+	for (std::vector <Folder *>::const_iterator it = folders.begin(); it != folders.end(); it++)
+		builder.addFolder ((*it)->_name, (*it)->refresh, (*it)->_expanded);
+	for (std::vector <Feed *>::const_iterator it = feeds.begin(); it != feeds.end(); it++) {
+		const Feed *feed = *it;
+		builder.addFeed (feed->url, feed->_title, feed->codeset, feed->retention,
+		                 feed->read_news, feed->_folder ? feed->_folder->pos : -1);
+	}
+	builder.finish (&state_data);
+
+	std::string error;
+	bool rotated = journal->rotate (error);
+	if (!rotated)
+		std::cout << "Error: couldn't start a new journal: " << error << std::endl;
+
+	g_atomic_int_set (&saving, rotated ? 2 : 1);
+	GError *err;
+	save_thread = g_thread_create (save_thread_cb, this, TRUE, &err);
+	if (!save_thread) {
+		printf ("Couldn't create thread for saving: %s\n", err->message);
+		save_thread_cb (this);
+	}
+	if (wait && save_thread) {
+		g_thread_join (save_thread);
+		save_thread = NULL;
+	}
+}
+
+gpointer Manager::save_thread_cb (gpointer data)
+{
+	Manager *pThis = (Manager *) data;
+	bool rotated = g_atomic_int_get (&pThis->saving) == 2;
+	// g_file_set_contents() writes aside and renames over, so a crash
+	// leaves either state whole (and the mapped one stays valid)
+	GError *error = NULL;
+	std::string path = prefix_homedir (STATE_FILE);
+	if (g_file_set_contents (path.c_str(), pThis->state_data.data(),
+	                         pThis->state_data.size(), &error)) {
+		if (rotated)
+			pThis->journal->discardOld();
+	}
+	else {
+		std::cout << "Error: couldn't save the state: " << error->message << std::endl;
+		g_error_free (error);
+	}
+	g_atomic_int_set (&pThis->saving, 0);
+	return 0;
+}
+
+// search keys of the interned names, e.g. "author:12"; a word can't have ':'
+static std::string key (const char *kind, guint32 id)
+{
+	gchar *str = g_strdup_printf ("%s%u", kind, id);
+	std::string key (str);
+	g_free (str);
+	return key;
+}
+
+void Manager::indexFeed (Feed *feed)
+{
+	if (index.wasteful()) {  // start over, without the gaps
+		index.clear();
+		for (std::vector <Feed *>::iterator it = feeds.begin(); it != feeds.end(); it++)
+			for (std::vector <News *>::iterator n = (*it)->news.begin();
+			     n != (*it)->news.end(); n++)
+				(*n)->doc = 0;
+		for (std::vector <Feed *>::iterator it = feeds.begin(); it != feeds.end(); it++)
+			if (*it != feed)
+				indexFeed (*it);
+	}
+
+	std::string text;
+	std::vector <std::string> keys;
+	for (std::vector <News *>::iterator it = feed->news.begin(); it != feed->news.end(); it++) {
+		News *news = *it;
+		if (news->doc)
+			continue;  // kept from the last refresh
+		text.assign (news->_title.c_str(), news->_title.size());
+		text += ' ';
+		text.append (news->_summary.c_str(), news->_summary.size());
+		text += ' ';
+		text += news->author();
+		keys.clear();
+		if (news->_author)
+			keys.push_back (key ("author:", news->_author));
+		if (news->site)
+			keys.push_back (key ("site:", news->site));
+		for (guint32 i = 0; i < news->categories_nb; i++) {
+			text += ' ';
+			text += News::categories_dict.name (news->_categories[i]);
+			keys.push_back (key ("category:", news->_categories[i]));
+		}
+		news->doc = index.add (news, text, keys);
+	}
+}
+
+void Manager::unindexNews (News *news)
+{ index.remove (news->doc); }
+
+void Manager::handOver (News *from, News *to)
+{
+	if (from->doc) {
+		index.replace (from->doc, to);
+		to->doc = from->doc;
+		from->doc = 0;
+	}
+	if (!from->deduped)
+		return;
+	to->deduped = true;
+	to->fp = from->fp;
+	to->original = from->original;
+	to->next_copy = from->next_copy;
+	if (from->original) {  // in its chain of copies
+		for (News *n = from->original; n; n = n->next_copy)
+			if (n->next_copy == from) {
+				n->next_copy = to;
+				break;
+			}
+	}
+	else {
+		dups.replace (from, to, from->fp);
+		for (News *n = to->next_copy; n; n = n->next_copy)
+			n->original = to;
+	}
+	from->deduped = false;
+	from->original = from->next_copy = NULL;
+}
+
+void Manager::search (const std::string &query, std::vector <News *> *results) const
+{
+	// "author:", "category:" and "site:" take the name as a whole
+	static const char *kinds[] = { "author:", "category:", "site:", 0 };
+	Dictionary *dicts[] = { &News::authors, &News::categories_dict, &News::sites };
+	std::vector <gpointer> docs;
+	int k;
+	for (k = 0; kinds[k]; k++)
+		if (!query.compare (0, strlen (kinds[k]), kinds[k])) {
+			std::string name (query, strlen (kinds[k]));
+			name.erase (0, name.find_first_not_of (' '));
+			guint32 id = dicts[k]->find (name);
+			if (id)
+				index.lookup (key (kinds[k], id), &docs);
+			break;
+		}
+	if (!kinds[k])
+		index.search (query, &docs);
+	results->reserve (docs.size());
+	for (std::vector <gpointer>::const_iterator it = docs.begin(); it != docs.end(); it++)
+		if (!((News *) *it)->isCopy())
+			results->push_back ((News *) *it);
+}
+
+void Manager::dedupFeed (Feed *feed)
+{
+	for (std::vector <News *>::iterator it = feed->news.begin(); it != feed->news.end(); it++) {
+		News *news = *it;
+		if (news->deduped)
+			continue;  // kept from the last refresh
+		news->deduped = true;
+		News *original = (News *) dups.find (news->fp, feed);
+		if (original) {
+			news->original = original;
+			if (!news->is_read) {  // a copy is counted with its original
+				feed->addUnread (-1);
+				feed->indexUnread (news);
+			}
+			news->next_copy = original->next_copy;
+			original->next_copy = news;
+			if (news->is_read != original->is_read)  // read if seen anywhere
+				news->setRead (true);
+		}
+		else
+			dups.add (news, news->fp, feed);
+	}
+}
+
+void Manager::undupNews (News *news)
+{
+	if (news->original) {
+		for (News **n = &news->original->next_copy; *n; n = &(*n)->next_copy)
+			if (*n == news) {
+				*n = news->next_copy;
+				break;
+			}
+		return;
+	}
+	// the first copy stands in for it
+	dups.remove (news, news->fp);
+	News *heir = news->next_copy;
+	if (heir) {
+		heir->original = NULL;
+		if (!heir->is_read) {
+			heir->feed->addUnread (1);
+			heir->feed->indexUnread (heir);
+		}
+		for (News *n = heir->next_copy; n; n = n->next_copy)
+			n->original = heir;
+		dups.add (heir, heir->fp, heir->feed);
+	}
+}
+
+void Manager::storeFeed (Feed *feed)
+{
+	feed->saveNews (store);
+	if (!store_timeout_id)
+		store_timeout_id = gdk_threads_add_timeout_seconds_full (G_PRIORITY_LOW, STORE_DELAY,
+			store_timeout, this, NULL);
+}
+
+void Manager::flushStore()
+{
+	std::string error;
+	if (!store->flush (error))
+		std::cout << "Error: couldn't save the news cache: " << error << std::endl;
+}
+
+void Manager::compactStore()
+{
+	// the batches of past refreshes add up; drop them when they're most of it
+	std::string error;
+	if (!compact_thread && store->wasteful()) {
+		if (store->compactStart (error)) {
+			compact_thread = g_thread_create_full (compact_thread_cb, this, 0, TRUE,
+				FALSE, G_THREAD_PRIORITY_LOW, NULL);
+			if (!compact_thread)
+				store->compactAbort();
+		}
+		else
+			std::cout << "Error: couldn't compact the news cache: " << error << std::endl;
+	}
+}
+
+gpointer Manager::compact_thread_cb (gpointer data)
+{
+	Manager *pThis = (Manager *) data;
+	pThis->compact_error.clear();
+	pThis->store->compactRun (pThis->compact_error);
+	gdk_threads_add_idle_full (G_PRIORITY_LOW, compact_done_cb, pThis, NULL);
+	return 0;
+}
+
+gboolean Manager::compact_done_cb (gpointer data)
+{
+	Manager *pThis = (Manager *) data;
+	g_thread_join (pThis->compact_thread);
+	pThis->compact_thread = NULL;
+	guint64 reclaimed;
+	std::string &error = pThis->compact_error;
+	if (!error.empty() || !pThis->store->compactFinish (&reclaimed, error)) {
+		pThis->store->compactAbort();
+		std::cout << "Error: couldn't compact the news cache: " << error << std::endl;
+	}
+	return FALSE;
+}
+
+gboolean Manager::store_timeout (gpointer data)
+{
+	Manager *pThis = (Manager *) data;
+	pThis->store_timeout_id = 0;
+	pThis->flushStore();
+	pThis->compactStore();
+	return FALSE;
 }
 
 void Manager::saveManager()
-{ Manager::get()->saveConfig(); }
+{
+	Manager *manager = Manager::get();
+	if (manager->compact_thread) {  // what it did is thrown away
+		g_thread_join (manager->compact_thread);
+		manager->compact_thread = NULL;
+		manager->store->compactAbort();
+	}
+	manager->flushStore();
+	manager->exportConfig();  // before the state, so it isn't taken as edited
+	manager->saveConfig (true);
+}
+
+// Timeline
+
+Timeline::Timeline (const Manager *manager, const Folder *folder)
+: total (folder ? folder->unreadNb() : manager->unreadNb())
+{
+	int first = folder ? folder->firstFeedNb() : 0;
+	int end = folder ? first + folder->feedsNb() : manager->feedsNb();
+	for (int i = first; i < end; i++) {
+		const Feed *feed = manager->getFeed (i);
+		Cursor cursor;
+		cursor.it = feed->by_date.begin();
+		cursor.end = feed->by_date.end();
+		push (cursor);
+	}
+}
 
+void Timeline::push (Cursor cursor)
+{
+	// copies are counted with their original
+	while (cursor.it != cursor.end && ((*cursor.it)->isRead() || (*cursor.it)->isCopy()))
+		cursor.it++;
+	if (cursor.it != cursor.end) {
+		cursor.time = news_time (*cursor.it);
+		heap.push_back (cursor);
+		std::push_heap (heap.begin(), heap.end());
+	}
+}
+
+News *Timeline::getNews (int nb)
+{
+	if (nb >= total)
+		return NULL;
+	// the newest of the feeds' newest, until there
+	while ((signed) news.size() <= nb && !heap.empty()) {
+		std::pop_heap (heap.begin(), heap.end());
+		Cursor cursor = heap.back();
+		heap.pop_back();
+		news.push_back (*cursor.it);
+		cursor.it++;
+		push (cursor);
+	}
+	return nb < (signed) news.size() ? news[nb] : NULL;
+}
@@ -6,57 +6,104 @@
 
 #include "parser.h"
 #include "xmlparser.h"
+#include "store.h"
+#include "idset.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "search.h"
+#include "dedup.h"
+#include "arena.h"
+#include "dictionary.h"
+#include "filter.h"
 #include <glib.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <list>
+#include <set>
 #include <vector>
 #include <string>
 
 class Feed;
+class Folder;
 class FeedManager;
+class Timeline;
 
 class News : public ParseNewsHandler
 {
-std::string _title, _summary, _link, _date, _updateDate, _author, _categories;
-std::string id, updateId;
+Text _title, _summary, _link;
+Text title_key;  // case-folded, to filter by
+Text id, updateId;
+Date _date, _updateDate;
 Feed *feed;
+Arena *arena;  // where it and its strings are
+guint32 _author, site;  // interned
+guint32 *_categories, categories_nb;  // in the arena
+guint32 pos;  // in the feed's news
 bool is_read;
+guint32 doc;  // in the search index; 0 if not there
+DupIndex::Fingerprint fp;
+bool deduped;  // looked up in the duplicates index
+News *original, *next_copy;  // a copy of another feed's news, if original
 
 public:
-	explicit News (Feed *feed);
+	static News *create (Feed *feed, Arena *arena);
+	static void destroy (News *news);
+	// a copy in another arena that takes its place, so that it can be
+	// destroyed and its arena freed
+	News *moveTo (Arena *arena);
 
 	bool isRead() const { return is_read; }
-	void setRead (bool read);
-
-	const std::string &title() const   { return _title; }
-	const std::string &summary() const { return _summary; }
-	const std::string &link() const    { return _link; }
-	const std::string &date() const    { return _date; }
-	const std::string &updateDate() const;
-	const std::string &author() const  { return _author; }
-	const std::string &categories() const  { return _categories; }
+	void setRead (bool read);  // of its copies too
+	bool isCopy() const { return original != NULL; }
+
+	const Text &title() const   { return _title; }
+	const Text &summary() const { return _summary; }
+	const Text &link() const    { return _link; }
+	const Date &date() const    { return _date; }
+	const Text &titleKey() const { return title_key; }
+	const Date &updateDate() const;
+	const std::string &author() const { return authors.name (_author); }
+	std::string categories() const;  // comma separated
 
 	const Feed *from() { return feed; }
+	// the same for the news once refreshed, which makes it anew
+	guint64 keyHash() const;
 
 private:
+	News (Feed *feed, Arena *arena);
+	~News();
+
 	virtual void setTitle (const std::string &title);
 	virtual void setSummary (const std::string &summary);
 	virtual void setContent (const std::string &content);
 	virtual void setLink (const std::string &link);
-	virtual void setDate (const std::string &date);
-	virtual void setUpdateDate (const std::string &date, const std::string &id);
+	virtual void setDate (const Date &date);
+	virtual void setUpdateDate (const Date &date, const std::string &id);
 	virtual void setAuthor (const std::string &author);
 	virtual void addCategory (const std::string &category);
 	virtual void setId (const std::string &id);
+	const Text &key() const;
+	void identify();  // once id is set
+	void markRead (bool read);
+	void complete();  // once all is set: fingerprint, site, title key
+	static Dictionary authors, categories_dict, sites;
 	friend class Feed;
+	friend class Manager;
 };
 
 class Feed : public ParseFeedHandler, XmlParser::Handler
 {
 std::string url, _title, _oriTitle, _description, _link, _author, _icon, _logo, codeset;
-std::vector <News *> news;
-std::list <std::string> read_news;
-std::string error_msg;
+std::string title_key;  // of the title shown, case-folded
+std::vector <News *> news, fetched;  // fetched: by the refresh under way
+std::vector <News *> by_date;  // news, newest first
+Arena *fetched_arena;
+IdSet read_news;
+Retention retention;  // its own, over the global one
+int unread;  // news not read, but for copies
+std::set <int> unread_pos;  // of those news
+int pos;  // in the manager's feeds
+Folder *_folder;  // NULL if at the top
+std::string error_msg, fetch_error;  // fetch_error: of the refresh, until merged
 bool _loading;
 GdkPixbuf *_iconPixbuf;
 
@@ -73,23 +120,40 @@ public:
 	const std::string &_url() const        { return url; }
 	const GdkPixbuf *iconPixbuf() const    { return _iconPixbuf; }
 	const std::string &logo() const        { return _logo; }
+	const std::string &titleKey() const    { return title_key; }
+	Folder *folder() const                 { return _folder; }
 
 	bool loading() const { return _loading; }
 	const std::string &errorMsg() const { return error_msg; }
 
 	News *getNews (int nb) const;
 	int getNewsNb (News *news) const;
+	int newsNb() const { return news.size(); }
 
 	void refresh();
-	int unreadNb() const;
+	int unreadNb() const { return unread; }
+	// of the news dated before that time (or all, if 0), told as one change
+	void markAllRead (gint64 before = 0);
+	// position of the first unread news after nb (or before, backwards),
+	// from either end for -1; -1 if none. Copies don't count, as above.
+	int nextUnread (int nb, bool backwards) const;
 
 	void setUserTitle (const std::string &title);
 
 private:
 	void clear();
+	void setKey();  // once the title changed
+	void merge();
+	bool wasRead (const News *news) const;  // as kept in read_news
+	void loaded();  // the refresh is over
+	void addUnread (int delta);
+	void indexUnread (News *news);  // once it is read, unread, or a copy
+	void recount();  // after news came or went
 
 	friend class News;
 	friend class Manager;
+	friend class Timeline;
+	friend class Folder;
 	void newsStatusChanged (News *news);
 
 	virtual void setTitle (const std::string &title);
@@ -112,29 +176,83 @@ private:
 		std::string &error) {}
 	virtual void endElement (const char *name, XmlParser::Handler *child,
 		std::string &error) {}
-	void saveConfig (std::ofstream &stream) const;
+	void saveConfig (std::ostream &stream) const;
+
+	// cache
+	void loadNews (Store *store);
+	void saveNews (Store *store) const;
+	void loadRead (Store *store);
+};
+
+// a group of feeds. The manager keeps the feeds of each folder together,
+// in the folders' order, ahead of those at the top.
+class Folder
+{
+std::string _name;
+int unread;  // of its feeds, as theirs change
+int refresh;  // minutes between refreshes; 0 for none, -1 for the default
+bool _expanded;
+int pos;  // in the manager's folders
+int first, count;  // its feeds, in the manager's
+
+public:
+	const std::string &name() const { return _name; }
+	int unreadNb() const { return unread; }
+	int refreshInterval() const { return refresh; }
+	bool expanded() const { return _expanded; }
+	void setExpanded (bool expanded) { _expanded = expanded; }
+
+	int firstFeedNb() const { return first; }
+	int feedsNb() const { return count; }
+
+private:
+	explicit Folder (const std::string &name);
+	friend class Feed;
+	friend class Manager;
 };
 
 class Manager : public XmlParser::Handler
 {
 public:
 	struct Listener {
-		virtual void feedStatusChange (Manager *manager, Feed *feed) = 0;
-		virtual void feedLoading (Manager *manager, Feed *feed) = 0;
-		virtual void feedLoaded (Manager *manager, Feed *feed) = 0;
+		// at most once a frame, of those that changed or loaded meanwhile
+		virtual void feedsChanged (Manager *manager, const std::vector <Feed *> &feeds) = 0;
+		virtual void feedsLoaded (Manager *manager, const std::vector <Feed *> &feeds) = 0;
 		virtual void feedsLoadingProgress (Manager *manager, float fraction) = 0;
 
-		// hack: to avoid telling Gtk exactly what rows were added/removed
-		// just tell the view reload the model
-		virtual void startStructuralChange (Manager *manager) = 0;
-		virtual void endStructuralChange (Manager *manager) = 0;
+		// once in place; a removed one is deleted after
+		virtual void feedAdded (Manager *manager, Feed *feed) = 0;
+		virtual void feedRemoved (Manager *manager, Feed *feed, int old_pos) = 0;
+		virtual void feedMoved (Manager *manager, Feed *feed, int old_pos) = 0;
+
+		// folders came, went or were renamed, or feeds went into others;
+		// a removed folder is deleted after
+		virtual void foldersChanged (Manager *manager) = 0;
 	};
 	void addListener (Listener *listener) { listeners.push_back (listener); }
 	void removeListener (Listener *listener) { listeners.remove (listener); }
 
 private:
+	static Manager *singleton;
 	std::vector <Feed *> feeds;
+	std::vector <Folder *> folders;
 	std::list <Listener *> listeners;
+	int unread;  // of all feeds
+	std::set <int> unread_feeds;  // positions of those with some
+	ParseLimits limits;
+	Retention retention;
+	Store *store;
+	guint store_timeout_id;
+	Journal *journal;
+	guint journal_timeout_id;
+	GThread *compact_thread;
+	std::string compact_error;
+	bool replaying;
+	Snapshot *state;  // as mapped at startup
+	GThread *save_thread;
+	volatile gint saving;  // 0 when done; 2 if the journal was rotated
+	std::string state_data;  // being saved
+	SearchIndex index;
 
 public:
 	explicit Manager();
@@ -143,38 +261,126 @@ public:
 	Feed *addFeed (const std::string &url, const std::string &title,
 	               const std::string &codeset = "");
 	void removeFeed (Feed *feed);
-	void move (Feed *feed, int new_pos);
+	void move (Feed *feed, int new_pos);  // among those of its folder
 	void refreshAll();
 
-	int unreadNb() const;
+	Folder *addFolder (const std::string &name);  // or the one of that name
+	void removeFolder (Folder *folder);  // its feeds go to the top
+	bool renameFolder (Folder *folder, const std::string &name);  // false if taken
+	void setRefreshInterval (Folder *folder, int minutes);
+	void setFolder (Feed *feed, Folder *folder);  // at its end; NULL for the top
+	// of the folder's feeds, or of all; see Feed::markAllRead()
+	void markAllRead (Folder *folder = NULL, gint64 before = 0);
+
+	int unreadNb() const { return unread; }
+	const ParseLimits &parseLimits() const { return limits; }
 
 	Feed *getFeed (int nb) const;
 	int getFeedNb (Feed *feed) const;
+	int feedsNb() const { return feeds.size(); }
+	Feed *findFeed (const std::string &url) const;
+
+	Folder *getFolder (int nb) const;
+	int getFolderNb (Folder *folder) const;
+	int foldersNb() const { return folders.size(); }
+	Folder *findFolder (const std::string &name) const;
+	int groupedNb() const;  // feeds in folders, which come first
+
+	// the first feed with unread news after nb (or before, backwards),
+	// going round past the end; NULL if none
+	Feed *nextUnreadFeed (int nb, bool backwards) const;
+
+	// news with all the words, across feeds
+	void search (const std::string &query, std::vector <News *> *results) const;
 
 private:
 	friend class Feed;
+	friend class News;
 	void feedStatusChanged (Feed *feed);
 	void feedLoading (Feed *feed);
-	void feedLoaded (Feed *feed);
+	void feedParsed (Feed *feed);  // from its thread, with the ui lock
 	int feeds_loading, feeds_loaded;
 
-	void notifyStartStructuralChange();
-	void notifyEndStructuralChange();
+	// what to tell the listeners when the frame is up
+	std::set <Feed *> changed_feeds;
+	std::vector <Feed *> parsed_feeds;  // to be merged then
+	bool progressed;
+	guint notify_timeout_id;
+	void notifyLater();
+	static gboolean notify_timeout (gpointer pData);
 
+	void renumber (int from, int to);
+	void placeFolders();  // after their feeds came or went
+
+	int minutes;  // since started
 	static gboolean refresh_timeout (gpointer pData);
 
+	// news cache
+	void storeFeed (Feed *feed);
+	void flushStore();
+	void compactStore();
+	static gboolean store_timeout (gpointer pData);
+	static gpointer compact_thread_cb (gpointer pData);
+	static gboolean compact_done_cb (gpointer pData);
+
+	// search
+	void indexFeed (Feed *feed);
+	void unindexNews (News *news);
+	// to takes from's place in the search and duplicates indexes, so
+	// that from can go without them being worked out again
+	void handOver (News *from, News *to);
+
+	// duplicates
+	DupIndex dups;
+	void dedupFeed (Feed *feed);
+	void undupNews (News *news);
+
+	// journal
+	void journalChange (Journal::Op op, const std::string &url,
+		const std::string &text = "", const std::string &extra = "",
+		gint64 value = 0);
+	void replay (const Journal::Entry &entry);
+	static gboolean journal_timeout (gpointer pData);
+
 	// config
 	void loadConfig();
+	Folder *config_folder;  // whose feeds are being read
 	virtual XmlParser::Handler *startElement (const char *name,
 		const char **attribute_names, const char **attribute_values,
 		std::string &error);
 	virtual void textElement (const char *name, const std::string &text,
 		std::string &error) {}
 	virtual void endElement (const char *name, XmlParser::Handler *child,
-		std::string &error) {}
-	void saveConfig() const;
+		std::string &error);
+	void importConfig (const std::string &path);
+	void exportConfig() const;
+	void saveConfig (bool wait);
+	static gpointer save_thread_cb (gpointer data);
 	static void saveManager();
 };
 
+// the unread news of all feeds (or of a folder's), newest first, as a
+// virtual feed: merged from the feeds' own orders only as far as rows are
+// asked for. It is to be made anew once feeds are loaded or removed.
+class Timeline
+{
+public:
+	explicit Timeline (const Manager *manager, const Folder *folder = NULL);
+	int newsNb() const { return total; }
+	News *getNews (int nb);
+
+private:
+	struct Cursor {
+		std::vector <News *>::const_iterator it, end;
+		gint64 time;  // of *it
+		bool operator < (const Cursor &c) const { return time < c.time; }
+	};
+	std::vector <Cursor> heap;  // of the feeds with some left
+	std::vector <News *> news;  // merged so far
+	int total;
+
+	void push (Cursor cursor);  // past the read ones; unless at the end
+};
+
 #endif /*FEED_H*/
 
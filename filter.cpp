@@ -0,0 +1,66 @@
+// filter.cpp
+
+#include "filter.h"
+#include <algorithm>
+#include <iterator>
+
+#define BUCKETS (1 << 14)  // trigrams sharing one just give more to check
+
+std::string filter_key (const char *text, gssize len)
+{
+	gchar *folded = g_utf8_casefold (text, len);
+	std::string key (folded);
+	g_free (folded);
+	return key;
+}
+
+static inline guint32 trigram (const char *s)
+{
+	guint32 h = ((guint8) s[0] << 16) | ((guint8) s[1] << 8) | (guint8) s[2];
+	h *= 2654435761u;
+	return h >> (32 - 14);
+}
+
+TrigramIndex::TrigramIndex()
+: lists (BUCKETS), count (0)
+{}
+
+void TrigramIndex::clear()
+{
+	for (unsigned int i = 0; i < lists.size(); i++)
+		std::vector <guint32>().swap (lists[i]);
+	count = 0;
+}
+
+void TrigramIndex::add (guint32 id, const char *key)
+{
+	for (const char *s = key; s[0] && s[1] && s[2]; s++) {
+		std::vector <guint32> &list = lists [trigram (s)];
+		if (list.empty() || list.back() != id)
+			list.push_back (id);
+	}
+	count++;
+}
+
+static bool shorter (const std::vector <guint32> *a, const std::vector <guint32> *b)
+{ return a->size() < b->size(); }
+
+bool TrigramIndex::candidates (const std::string &text, std::vector <guint32> *ids) const
+{
+	if (text.size() < 3)
+		return false;
+	std::vector <const std::vector <guint32> *> with;
+	for (unsigned int i = 0; i + 2 < text.size(); i++)
+		with.push_back (&lists [trigram (text.data() + i)]);
+	std::sort (with.begin(), with.end(), shorter);
+
+	*ids = *with[0];
+	std::vector <guint32> both;
+	for (unsigned int i = 1; i < with.size() && !ids->empty(); i++) {
+		both.clear();
+		std::set_intersection (ids->begin(), ids->end(), with[i]->begin(), with[i]->end(),
+			std::back_inserter (both));
+		ids->swap (both);
+	}
+	return true;
+}
@@ -0,0 +1,41 @@
+// filter.h
+// narrowing lists to the rows whose title has the text being typed
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <glib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// below it, going through all the keys is about as quick as the index
+#define TRIGRAM_MIN_ROWS 2048
+
+// titles are matched case-folded, as kept in these keys
+std::string filter_key (const char *text, gssize len = -1);
+
+// whether a key has the filter, also a key; any has an empty one
+inline bool filter_match (const char *key, const std::string &filter)
+{ return filter.empty() || strstr (key, filter.c_str()); }
+
+// the keys that have all the three letter pieces of the text; some may
+// not have the text as a whole, so they are to be checked
+class TrigramIndex
+{
+public:
+	TrigramIndex();
+
+	void clear();
+	bool empty() const { return !count; }
+	void add (guint32 id, const char *key);  // by increasing ids
+
+	// false if the text is too short to tell, and any key may have it
+	bool candidates (const std::string &text, std::vector <guint32> *ids) const;
+
+private:
+	std::vector <std::vector <guint32> > lists;  // ids, by trigram hash
+	size_t count;
+};
+
+#endif /*FILTER_H*/
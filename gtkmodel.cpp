@@ -2,6 +2,7 @@
 
 #include "gtkmodel.h"
 #include <gtk/gtk.h>
+#include <vector>
 
 static inline int get_iter_row (GtkTreeIter *iter)
 { return GPOINTER_TO_INT (iter->user_data); }
@@ -12,37 +13,61 @@ static inline void set_iter_row (GtkTreeIter *iter, int row)
 int gtk_my_model_get_iter_row (GtkTreeIter *iter)
 { return get_iter_row (iter); }
 
-static int gtk_my_model_rows_nb (GtkTreeModel *model)
-{
-	GtkMyModel *mmodel = GTK_MY_MODEL (model);
-	return mmodel->model->rowsNb();
-}
+static inline TableModel *table_of (GtkTreeModel *model)
+{ return GTK_MY_MODEL (model)->model; }
+
+// the row of an iter, or the top (-1) if none
+static inline int parent_row (GtkTreeIter *iter)
+{ return iter ? get_iter_row (iter) : -1; }
 
 static GtkTreeModelFlags gtk_my_model_get_flags (GtkTreeModel *model)
 {
-	return (GtkTreeModelFlags) GTK_TREE_MODEL_LIST_ONLY;
+	return (GtkTreeModelFlags) (table_of (model)->isTree() ? 0 : GTK_TREE_MODEL_LIST_ONLY);
 }
 
 static gboolean gtk_my_model_get_iter (GtkTreeModel *model, GtkTreeIter *iter, GtkTreePath  *path)
 {
-	int row = *gtk_tree_path_get_indices (path);
+	TableModel *table = table_of (model);
+	int depth = gtk_tree_path_get_depth (path), *indices = gtk_tree_path_get_indices (path);
+	int row = -1;
+	for (int i = 0; i < depth; i++) {
+		if (indices[i] < 0 || indices[i] >= table->childrenNb (row))
+			return FALSE;
+		row = table->childRow (row, indices[i]);
+	}
 	set_iter_row (iter, row);
-	return row < gtk_my_model_rows_nb (model);
+	return depth > 0;
 }
 
-static GtkTreePath *gtk_my_model_get_path (GtkTreeModel *model, GtkTreeIter *iter)
+static GtkTreePath *row_path (TableModel *table, int row)
 {
-	int row = get_iter_row (iter);
 	GtkTreePath *path = gtk_tree_path_new();
-	gtk_tree_path_append_index (path, row);
+	for (; row >= 0; row = table->parentRow (row))
+		gtk_tree_path_prepend_index (path, table->rowIndex (row));
 	return path;
 }
 
+static GtkTreePath *gtk_my_model_get_path (GtkTreeModel *model, GtkTreeIter *iter)
+{
+	return row_path (table_of (model), get_iter_row (iter));
+}
+
+GtkTreePath *gtk_my_model_get_row_path (GtkTreeModel *model, int row)
+{ return row_path (table_of (model), row); }
+
 static gboolean gtk_my_model_iter_next (GtkTreeModel *model, GtkTreeIter *iter)
 {
-	int row = get_iter_row (iter) + 1;
-	set_iter_row (iter, row);
-	return row < gtk_my_model_rows_nb (model);
+	TableModel *table = table_of (model);
+	int row = get_iter_row (iter);
+	if (!table->isTree()) {
+		set_iter_row (iter, ++row);
+		return row < table->rowsNb();
+	}
+	int parent = table->parentRow (row), index = table->rowIndex (row) + 1;
+	if (index >= table->childrenNb (parent))
+		return FALSE;
+	set_iter_row (iter, table->childRow (parent, index));
+	return TRUE;
 }
 
 static gint gtk_my_model_get_n_columns (GtkTreeModel *model)
@@ -57,48 +82,159 @@ static GType gtk_my_model_get_column_type (GtkTreeModel *model, gint column)
 	return mmodel->model->columnType (column);
 }
 
-static void gtk_my_model_get_value (GtkTreeModel *model, GtkTreeIter *iter, gint col, GValue *value)
+static gboolean gtk_my_model_iter_parent (GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter  *child)
 {
-	GtkMyModel *mmodel = GTK_MY_MODEL (model);
-	int row = get_iter_row (iter);
-	mmodel->model->columnValue (row, col, value);
+	int row = table_of (model)->parentRow (get_iter_row (child));
+	set_iter_row (iter, row);
+	return row >= 0;
 }
 
-static gboolean gtk_my_model_iter_parent (GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter  *child)
-{ return FALSE; }
-
 static gboolean gtk_my_model_iter_has_child (GtkTreeModel *model, GtkTreeIter *iter)
-{ return FALSE; }
+{ return table_of (model)->childrenNb (get_iter_row (iter)) > 0; }
 
 static gint gtk_my_model_iter_n_children (GtkTreeModel *model, GtkTreeIter *iter)
-{ return 0; }
+{ return table_of (model)->childrenNb (parent_row (iter)); }
 
 static gboolean gtk_my_model_iter_nth_child (GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent, gint n)
-{ return FALSE; }
+{
+	TableModel *table = table_of (model);
+	int row = parent_row (parent);
+	if (n < 0 || n >= table->childrenNb (row))
+		return FALSE;
+	set_iter_row (iter, table->childRow (row, n));
+	return TRUE;
+}
 
 static gboolean gtk_my_model_iter_children (GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter  *parent)
-{ return FALSE; }
+{ return gtk_my_model_iter_nth_child (model, iter, parent, 0); }
 
 
 struct GtkMyModel::Listener : public TableModel::Listener
 {
 	Listener (TableModel *table, GtkTreeModel *model)
-	: model (model)
+	: model (model), table (table), columns (table->columnsNb()), stamp (1)
 	{ table->setListener (this); }
 
+	~Listener()
+	{ clear (0); }
+
 	GtkTreeModel *model;
 
+	// the value cache: a cell is good while its stamp is the current one
+	const GValue *value (int row, int col)
+	{
+		if ((row + 1) * columns > (signed) cells.size())
+			cells.resize ((row + 1) * columns, empty_cell());
+		Cell &cell = cells [row * columns + col];
+		if (cell.stamp != stamp) {
+			if (G_IS_VALUE (&cell.value))
+				g_value_unset (&cell.value);
+			table->columnValue (row, col, &cell.value);
+			cell.stamp = stamp;
+		}
+		return &cell.value;
+	}
+
 private:
+	struct Cell {
+		GValue value;
+		guint stamp;  // 0 for none
+	};
+	TableModel *table;
+	int columns;
+	std::vector <Cell> cells;  // by row, then column
+	guint stamp;
+
+	static Cell empty_cell()
+	{ return Cell(); }  // zeroed, as a GValue must be before init
+
+	// unsets the cells from the given one on
+	void clear (size_t from)
+	{
+		for (size_t i = from; i < cells.size(); i++)
+			if (G_IS_VALUE (&cells[i].value))
+				g_value_unset (&cells[i].value);
+		cells.resize (MIN (from, cells.size()));
+	}
+
 	virtual void rowChanged (int row)
 	{
+		for (int col = 0; col < columns && (row + 1) * columns <= (signed) cells.size(); col++)
+			cells [row * columns + col].stamp = 0;
+
 		GtkTreeIter iter;
 		set_iter_row (&iter, row);
 		GtkTreePath *path = gtk_my_model_get_path (model, &iter);
 		gtk_tree_model_row_changed (model, path, &iter);
 		gtk_tree_path_free (path);
 	}
+
+	virtual void rowInserted (int row)
+	{
+		if (row * columns < (signed) cells.size())
+			cells.insert (cells.begin() + row * columns, columns, empty_cell());
+
+		GtkTreeIter iter;
+		set_iter_row (&iter, row);
+		GtkTreePath *path = gtk_my_model_get_path (model, &iter);
+		gtk_tree_model_row_inserted (model, path, &iter);
+		gtk_tree_path_free (path);
+	}
+
+	virtual void rowDeleted (int row)
+	{ rowDeleted (row, -1, row); }
+
+	virtual void rowDeleted (int row, int parent, int index)
+	{
+		if ((row + 1) * columns <= (signed) cells.size()) {
+			for (int col = 0; col < columns; col++)
+				if (G_IS_VALUE (&cells [row * columns + col].value))
+					g_value_unset (&cells [row * columns + col].value);
+			cells.erase (cells.begin() + row * columns, cells.begin() + (row + 1) * columns);
+		}
+
+		GtkTreePath *path = row_path (table, parent);
+		gtk_tree_path_append_index (path, index);
+		gtk_tree_model_row_deleted (model, path);
+		gtk_tree_path_free (path);
+	}
+
+	virtual void rowHasChildToggled (int row)
+	{
+		GtkTreeIter iter;
+		set_iter_row (&iter, row);
+		GtkTreePath *path = row_path (table, row);
+		gtk_tree_model_row_has_child_toggled (model, path, &iter);
+		gtk_tree_path_free (path);
+	}
+
+	virtual void rowsReordered (int parent, int *new_order)
+	{
+		rowsChanged();
+		GtkTreeIter iter;
+		set_iter_row (&iter, parent);
+		GtkTreePath *path = row_path (table, parent);
+		gtk_tree_model_rows_reordered (model, path, parent < 0 ? NULL : &iter, new_order);
+		gtk_tree_path_free (path);
+	}
+
+	virtual void rowsChanged()
+	{
+		clear (table->rowsNb() * columns);  // those past the end are of no use
+		if (!++stamp)
+			stamp = 1;
+	}
 };
 
+static void gtk_my_model_get_value (GtkTreeModel *model, GtkTreeIter *iter, gint col, GValue *value)
+{
+	GtkMyModel *mmodel = GTK_MY_MODEL (model);
+	const GValue *cached = mmodel->listener->value (get_iter_row (iter), col);
+	g_value_init (value, G_VALUE_TYPE (cached));
+	// strings copied too: the caller may hold them past the next change
+	g_value_copy (cached, value);
+}
+
 static void gtk_my_model_tree_model_init (GtkTreeModelIface *iface);
 static void gtk_my_model_drag_source_init (GtkTreeDragSourceIface *iface);
 static void gtk_my_model_drag_dest_init (GtkTreeDragDestIface *iface);
@@ -146,11 +282,22 @@ static gboolean gtk_my_model_drag_data_received (GtkTreeDragDest *drag_dest,
 	gboolean ret = FALSE;
 	if (gtk_tree_get_row_drag_data (selection_data, &src_model, &src_path))
 		if (src_model == model) {
-			int new_row = *gtk_tree_path_get_indices (dst_path);
-			GtkTreeIter src_iter;
-			if (gtk_my_model_get_iter (model, &src_iter, src_path)) {
+			// dst_path may not exist yet: its parent is looked up instead
+			int depth = gtk_tree_path_get_depth (dst_path);
+			int index = gtk_tree_path_get_indices (dst_path) [depth - 1];
+			int parent = -1;
+			GtkTreeIter src_iter, parent_iter;
+			GtkTreePath *parent_path = gtk_tree_path_copy (dst_path);
+			if (gtk_tree_path_up (parent_path) && gtk_tree_path_get_depth (parent_path) > 0) {
+				if (gtk_my_model_get_iter (model, &parent_iter, parent_path))
+					parent = get_iter_row (&parent_iter);
+				else
+					depth = 0;
+			}
+			gtk_tree_path_free (parent_path);
+			if (depth > 0 && gtk_my_model_get_iter (model, &src_iter, src_path)) {
 				int row = get_iter_row (&src_iter);
-				mmodel->model->moveRow (row, new_row);
+				mmodel->model->moveRow (row, parent, index);
 				ret = TRUE;
 			}
 		}
@@ -1,24 +1,80 @@
 // gtkmodel.h
-// GtkTreeModel simplifying wrapper
+// GtkTreeModel simplifying wrapper; it keeps the values it was given until
+// told they changed, as Gtk asks for them on every redraw
 
 #ifndef MY_MODEL_H
 #define MY_MODEL_H
 
 #include <gtk/gtktreemodel.h>
+#include <algorithm>
+#include <vector>
 
 struct TableModel {
 	virtual int rowsNb() const = 0;
 	virtual int columnsNb() const = 0;
 	virtual GType columnType (int col) const = 0;
 	virtual void columnValue (int row, int col, GValue *value) = 0;
-	virtual void moveRow (int row, int newRow) = 0;
+	virtual void moveRow (int row, int parent, int index) = 0;  // to under parent
 
+	// a tree, rather than a list, if rows have children: rows are then
+	// numbered through all of it, and placed by these; -1 is the top
+	virtual bool isTree() const { return false; }
+	virtual int parentRow (int row) const { return -1; }
+	virtual int childrenNb (int row) const { return row < 0 ? rowsNb() : 0; }
+	virtual int childRow (int row, int nb) const { return nb; }
+	virtual int rowIndex (int row) const { return row; }  // under its parent
+
+	// rowsNb() is asked often, so it should be quick; the listener is to be
+	// told of changes once they are made, rather than rebuilding the model
 	struct Listener {
 		virtual void rowChanged (int row) = 0;
+		virtual void rowInserted (int row) = 0;
+		virtual void rowDeleted (int row) = 0;
+		virtual void rowsReordered (int parent, int *new_order) = 0;  // old index of each
+		virtual void rowsChanged() = 0;  // any of them; the view is to be redrawn
+
+		// of a tree: where the deleted row was, and once a row got its
+		// first child or lost its last
+		virtual void rowDeleted (int row, int parent, int index) = 0;
+		virtual void rowHasChildToggled (int row) = 0;
 	};
 	virtual void setListener (Listener *listener) = 0;
 };
 
+// beyond so many row signals, rebuilding the view is quicker
+#define MAX_ROW_SIGNALS 1024
+
+// tells the listener which rows went and came, from one list of the items
+// shown to the other. It tells nothing and returns false if those kept are
+// no longer in the same order, or if too many changed.
+template <typename T>
+bool update_rows (TableModel::Listener *listener, const std::vector <T> &old,
+                  const std::vector <T> &now)
+{
+	std::vector <T> old_set (old), now_set (now);
+	std::sort (old_set.begin(), old_set.end());
+	std::sort (now_set.begin(), now_set.end());
+	std::vector <T> kept;
+	for (unsigned int i = 0; i < now.size(); i++)
+		if (std::binary_search (old_set.begin(), old_set.end(), now[i]))
+			kept.push_back (now[i]);
+	size_t changed = old.size() + now.size() - 2 * kept.size();
+	if (changed > MAX_ROW_SIGNALS)
+		return false;
+	unsigned int k = 0;
+	for (unsigned int i = 0; i < old.size(); i++)
+		if (std::binary_search (now_set.begin(), now_set.end(), old[i]) && kept[k++] != old[i])
+			return false;
+
+	for (int i = old.size() - 1; i >= 0; i--)  // bottom up, keeping the rows above
+		if (!std::binary_search (now_set.begin(), now_set.end(), old[i]))
+			listener->rowDeleted (i);
+	for (unsigned int i = 0; i < now.size(); i++)
+		if (!std::binary_search (old_set.begin(), old_set.end(), now[i]))
+			listener->rowInserted (i);
+	return true;
+}
+
 #define GTK_TYPE_MY_MODEL (gtk_my_model_get_type ())
 #define GTK_MY_MODEL(obj) \
 	(G_TYPE_CHECK_INSTANCE_CAST ((obj), GTK_TYPE_MY_MODEL, GtkMyModel))
@@ -41,6 +97,7 @@ GtkTreeModel *gtk_my_model_new (TableModel *model);
 GType gtk_my_model_get_type (void) G_GNUC_CONST;
 
 int gtk_my_model_get_iter_row (GtkTreeIter *iter);
+GtkTreePath *gtk_my_model_get_row_path (GtkTreeModel *model, int row);
 
 #endif /*MY_MODEL_H*/
 
@@ -0,0 +1,132 @@
+// idset.cpp
+
+#include "idset.h"
+#include <string.h>
+
+#define MIN_SLOTS 16
+
+IdSet::IdSet()
+: slots (MIN_SLOTS, 0), _table (&slots[0]), mask (MIN_SLOTS - 1), count (0)
+{}
+
+guint64 IdSet::hash (const char *id, size_t len)
+{
+	// FNV-1a, then mixed so that the low bits (the slot) depend on all of it
+	guint64 h = G_GUINT64_CONSTANT (14695981039346656037);
+	for (unsigned int i = 0; i < len; i++)
+		h = (h ^ (guchar) id[i]) * G_GUINT64_CONSTANT (1099511628211);
+	h ^= h >> 33;
+	h *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	return fix (h);
+}
+
+size_t IdSet::find (guint64 hash) const
+{
+	// linear probing: the table is at most half full
+	size_t i = hash & mask;
+	while (_table[i] && _table[i] != hash)
+		i = (i + 1) & mask;
+	return i;
+}
+
+bool IdSet::contains (guint64 hash) const
+{ return _table [find (fix (hash))] != 0; }
+
+void IdSet::own()
+{
+	if (slots.empty()) {  // attached
+		slots.assign (_table, _table + mask + 1);
+		_table = &slots[0];
+	}
+}
+
+void IdSet::insert (guint64 hash)
+{
+	hash = fix (hash);
+	size_t i = find (hash);
+	if (_table[i])
+		return;
+	own();
+	slots[i] = hash;
+	if (++count * 2 > slots.size())
+		grow();
+}
+
+void IdSet::remove (guint64 hash)
+{
+	hash = fix (hash);
+	size_t i = find (hash);
+	if (!_table[i])
+		return;
+	own();
+	// shift back the entries after it that would no longer be found
+	size_t j = i;
+	while (true) {
+		slots[i] = 0;
+		while (true) {
+			j = (j + 1) & mask;
+			if (!slots[j])
+				break;
+			size_t home = slots[j] & mask;
+			// move j into the hole unless its home lies cyclically in (i, j]
+			if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+				break;
+		}
+		if (!slots[j])
+			break;
+		slots[i] = slots[j];
+		i = j;
+	}
+	count--;
+}
+
+void IdSet::clear()
+{
+	slots.assign (MIN_SLOTS, 0);
+	_table = &slots[0];
+	mask = MIN_SLOTS - 1;
+	count = 0;
+}
+
+void IdSet::grow()
+{
+	std::vector <guint64> old (slots.size() * 2, 0);
+	old.swap (slots);
+	_table = &slots[0];
+	mask = slots.size() - 1;
+	for (unsigned int i = 0; i < old.size(); i++)
+		if (old[i])
+			slots [find (old[i])] = old[i];
+}
+
+void IdSet::save (std::string *data) const
+{
+	data->assign ((const char *) _table, (mask + 1) * sizeof (guint64));
+}
+
+bool IdSet::attach (const guint64 *table, size_t n, size_t used)
+{
+	if (n < MIN_SLOTS || (n & (n-1)) || used * 2 > n)  // not one of ours
+		return false;
+	slots.clear();
+	_table = table;
+	mask = n - 1;
+	count = used;
+	return true;
+}
+
+bool IdSet::load (const std::string &data)
+{
+	const guint64 *table = (const guint64 *) data.data();
+	size_t n = data.size() / sizeof (guint64), used = 0;
+	for (unsigned int i = 0; i < n; i++)
+		if (table[i])
+			used++;
+	if (n * sizeof (guint64) != data.size() || !attach (table, n, used)) {
+		clear();
+		return false;
+	}
+	own();
+	return true;
+}
@@ -0,0 +1,55 @@
+// idset.h
+// a set of news ids, kept as 64 bits hashes in an open addressing table
+
+#ifndef IDSET_H
+#define IDSET_H
+
+#include <glib.h>
+#include <string>
+#include <vector>
+
+class IdSet
+{
+public:
+	IdSet();
+
+	// two ids sharing a hash are taken as the same one; with 64 bits, that
+	// is not expected to happen among the ids of a feed
+	static guint64 hash (const char *id, size_t len);
+	static guint64 hash (const std::string &id) { return hash (id.data(), id.size()); }
+
+	bool contains (guint64 hash) const;
+	void insert (guint64 hash);
+	void remove (guint64 hash);
+	void clear();
+	size_t size() const { return count; }
+
+	bool contains (const std::string &id) const { return contains (hash (id)); }
+	void insert (const std::string &id) { insert (hash (id)); }
+	void remove (const std::string &id) { remove (hash (id)); }
+
+	// the table as it is in memory, so loading is a copy
+	void save (std::string *data) const;
+	bool load (const std::string &data);
+
+	// or no copy at all: slots (as given by table(), holding size() ids) are
+	// used in place until the set is changed; they must outlive it
+	bool attach (const guint64 *slots, size_t slots_nb, size_t ids_nb);
+	const guint64 *table() const { return _table; }
+	size_t tableSize() const { return mask + 1; }
+
+private:
+	std::vector <guint64> slots;  // 0 for an empty slot
+	const guint64 *_table;  // slots, or attached ones
+	size_t mask, count;
+
+	IdSet (const IdSet &);
+	IdSet &operator = (const IdSet &);
+	void own();
+
+	static guint64 fix (guint64 hash) { return hash ? hash : 1; }
+	size_t find (guint64 hash) const;  // its slot, or the empty one it'd go to
+	void grow();
+};
+
+#endif /*IDSET_H*/
@@ -0,0 +1,179 @@
+// journal.cpp
+
+#include "journal.h"
+#include "store.h"
+#include <glib/gstdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// file: records of length (4 bytes), checksum (4), then the entry encoded
+// as a store batch
+
+Journal::Journal (const std::string &dir)
+: path (dir + "/journal"), old_path (dir + "/journal.old"), fd (-1), file_size (0)
+{}
+
+Journal::~Journal()
+{
+	if (fd >= 0)
+		close (fd);
+}
+
+size_t Journal::read (const std::string &file, std::vector <Entry> *entries)
+{
+	gchar *contents;
+	gsize len;
+	if (!g_file_get_contents (file.c_str(), &contents, &len, NULL))
+		return 0;
+	const char *p = contents, *end = contents + len;
+	while (end - p >= 8) {
+		guint32 size, sum;
+		memcpy (&size, p, 4);
+		memcpy (&sum, p + 4, 4);
+		if ((size_t) (end - p - 8) < size || Store::checksum (p + 8, size) != sum)
+			break;
+		std::string data (p + 8, size);
+		Store::Reader reader (data);
+		Entry entry;
+		gint64 op;
+		reader.getInt (&op);
+		reader.getString (&entry.url);
+		reader.getString (&entry.text);
+		reader.getString (&entry.extra);
+		reader.getInt (&entry.value);
+		if (!reader.ok())
+			break;
+		entry.op = op;
+		if (entries)
+			entries->push_back (entry);
+		p += 8 + size;
+	}
+	size_t valid = p - contents;
+	g_free (contents);
+	return valid;
+}
+
+void Journal::replay (std::vector <Entry> *entries)
+{
+	read (old_path, entries);  // a save that didn't finish
+	read (path, entries);
+}
+
+bool Journal::open (std::string &error)
+{
+	fd = ::open (path.c_str(), O_WRONLY | O_CREAT, 0600);
+	if (fd < 0) {
+		error = "couldn't open " + path + ": " + g_strerror (errno);
+		return false;
+	}
+	// cut a record left half-written, or it'd hide the ones after it
+	file_size = read (path, NULL);
+	if (ftruncate (fd, file_size) != 0) {
+		error = "couldn't truncate " + path + ": " + g_strerror (errno);
+		return false;
+	}
+	lseek (fd, file_size, SEEK_SET);
+	return true;
+}
+
+void Journal::append (const Entry &entry)
+{
+	Store::Writer writer;
+	writer.putInt (entry.op);
+	writer.putString (entry.url);
+	writer.putString (entry.text);
+	writer.putString (entry.extra);
+	writer.putInt (entry.value);
+	guint32 header[2] = { (guint32) writer.data.size(),
+		Store::checksum (writer.data.data(), writer.data.size()) };
+	buffer.append ((const char *) header, 8);
+	buffer += writer.data;
+}
+
+bool Journal::flush (std::string &error)
+{
+	if (fd < 0 || buffer.empty())
+		return true;
+	const char *p = buffer.data();
+	size_t len = buffer.size();
+	while (len) {
+		ssize_t n = write (fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			error = "couldn't write " + path + ": " + g_strerror (errno);
+			buffer.erase (0, p - buffer.data());  // the rest is kept for the next try
+			return false;
+		}
+		p += n; len -= n;
+		file_size += n;
+	}
+	buffer.clear();
+	if (fdatasync (fd) != 0) {
+		error = "couldn't sync " + path + ": " + g_strerror (errno);
+		return false;
+	}
+	return true;
+}
+
+// the old file is still there if the last save failed: the entries go
+// after its own then, as they are yet to be saved too
+bool Journal::appendToOld (std::string &error)
+{
+	gchar *contents = NULL;
+	gsize len = 0;
+	g_file_get_contents (path.c_str(), &contents, &len, NULL);
+	int old_fd = ::open (old_path.c_str(), O_WRONLY);
+	bool ok = old_fd >= 0;
+	if (ok) {
+		// past a record cut short, the ones after it would be lost
+		off_t valid = read (old_path, NULL);
+		ok = ftruncate (old_fd, valid) == 0 && lseek (old_fd, valid, SEEK_SET) == valid;
+		for (gsize done = 0; ok && done < len; ) {
+			ssize_t n = write (old_fd, contents + done, len - done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			ok = n >= 0;
+			if (ok)
+				done += n;
+		}
+		ok = ok && fdatasync (old_fd) == 0;
+	}
+	if (!ok)
+		error = "couldn't append to " + old_path + ": " + g_strerror (errno);
+	if (old_fd >= 0)
+		close (old_fd);
+	g_free (contents);
+	if (ok && g_unlink (path.c_str()) && errno != ENOENT) {
+		error = "couldn't remove " + path + ": " + g_strerror (errno);
+		ok = false;
+	}
+	return ok;
+}
+
+bool Journal::rotate (std::string &error)
+{
+	if (!flush (error))
+		return false;
+	if (fd >= 0)
+		close (fd);
+	fd = -1;
+	if (g_file_test (old_path.c_str(), G_FILE_TEST_EXISTS)) {
+		if (!appendToOld (error)) {
+			std::string ignored;
+			open (ignored);
+			return false;
+		}
+	}
+	else if (g_rename (path.c_str(), old_path.c_str()) && errno != ENOENT) {
+		error = "couldn't rename " + path + ": " + g_strerror (errno);
+		open (error);
+		return false;
+	}
+	return open (error);
+}
+
+void Journal::discardOld()
+{ g_unlink (old_path.c_str()); }
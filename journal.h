@@ -0,0 +1,62 @@
+// journal.h
+// write-ahead log of the changes made since the config was last saved
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <glib.h>
+#include <string>
+#include <vector>
+
+class Journal
+{
+public:
+	enum Op {
+		READ, UNREAD,  // value: IdSet hash of the news id
+		RENAME,        // text: the user title
+		MOVE,          // value: the new position
+		ADD,           // text: title, extra: codeset
+		REMOVE,
+		FILE,          // text: the folder, or none
+		// of folders, without url; text: the name
+		FOLDER_ADD, FOLDER_REMOVE,
+		FOLDER_RENAME,   // extra: the new name
+		FOLDER_REFRESH,  // value: the minutes between refreshes
+		READ_MANY        // of a feed; text: IdSet hashes of news ids, 8 bytes each
+	};
+	struct Entry {
+		int op;
+		std::string url, text, extra;
+		gint64 value;
+	};
+
+	explicit Journal (const std::string &dir);
+	~Journal();
+
+	// entries of the files left over, oldest first; entries after one
+	// that was cut short (by a crash) are lost
+	void replay (std::vector <Entry> *entries);
+	bool open (std::string &error);
+
+	// append() only queues: flush() writes them all with one sync
+	void append (const Entry &entry);
+	bool pending() const { return !buffer.empty(); }
+	bool flush (std::string &error);
+	size_t size() const { return file_size; }
+
+	// starts a new file; the old one is kept until its changes are saved
+	// elsewhere, and then discardOld() (which may be called from any thread)
+	bool rotate (std::string &error);
+	void discardOld();
+
+private:
+	std::string path, old_path, buffer;
+	int fd;
+	size_t file_size;
+
+	// returns the length of the valid part
+	size_t read (const std::string &file, std::vector <Entry> *entries);
+	bool appendToOld (std::string &error);
+};
+
+#endif /*JOURNAL_H*/
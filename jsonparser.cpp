@@ -0,0 +1,399 @@
+// jsonparser.cpp
+
+#include "jsonparser.h"
+#include <glib.h>
+#include <string.h>
+#include <vector>
+
+struct JsonParser::Impl
+{
+	enum State { VALUE, FIRST_VALUE, MEMBER, FIRST_MEMBER, COLON, NEXT,
+		STRING, ESCAPE, UNICODE, LITERAL, DONE };
+
+	struct Frame {
+		bool object;
+		std::string key;
+		JsonParser::Handler *handler;
+	};
+
+	// takes the objects no handler wanted, and what is in them
+	struct Skipper : public JsonParser::Handler {
+		virtual Handler *startObject (const char *key, std::string &error)
+		{ return NULL; }
+		virtual void value (const char *key, const char *text, size_t len,
+			std::string &error) {}
+		virtual void endObject (const char *key, Handler *child, std::string &error) {}
+	};
+	Skipper skipper;
+
+	JsonParser::Handler *handler;
+	std::vector <Frame> stack;
+	State state;
+	std::string key, buffer, failure;
+	bool in_key, pieced;  // pieced: string didn't come in one go
+	gunichar unicode, surrogate;
+	int unicode_digits;
+	size_t offset;
+	int max_depth;
+	size_t max_text;
+
+	Impl (JsonParser::Handler *handler)
+	: handler (handler), state (VALUE), in_key (false), pieced (false),
+	  unicode (0), surrogate (0), unicode_digits (0), offset (0),
+	  max_depth (0), max_text (0)
+	{}
+
+	JsonParser::Handler *top()
+	{ return stack.empty() ? handler : stack.back().handler; }
+
+	// name the current value goes by
+	const char *valueKey()
+	{
+		if (stack.empty())
+			return NULL;
+		return stack.back().object ? key.c_str() : stack.back().key.c_str();
+	}
+
+	void fail (const char *p, const char *chunk, const char *what, std::string &error)
+	{
+		gchar *str = g_strdup_printf ("JSON error at byte %lu: %s",
+			(unsigned long) (offset + (p - chunk)), what);
+		error = str;
+		g_free (str);
+	}
+
+	bool open (bool object, std::string &error)
+	{
+		if (max_depth && (int) stack.size() >= max_depth) {
+			gchar *str = g_strdup_printf ("Values nested deeper than %d levels", max_depth);
+			error = str;
+			g_free (str);
+			return false;
+		}
+		Frame frame;
+		frame.object = object;
+		const char *name = valueKey();
+		frame.key = name ? name : "";
+		frame.handler = top();
+		if (object) {
+			JsonParser::Handler *child = frame.handler->startObject (name, error);
+			frame.handler = child ? child : &skipper;
+		}
+		stack.push_back (frame);
+		state = object ? FIRST_MEMBER : FIRST_VALUE;
+		return error.empty();
+	}
+
+	bool close (std::string &error)
+	{
+		Frame frame = stack.back();
+		stack.pop_back();
+		if (frame.object) {
+			JsonParser::Handler *parent = top(), *child = frame.handler;
+			if (child == parent || child == &skipper) child = NULL;
+			parent->endObject (stack.empty() ? NULL : frame.key.c_str(), child, error);
+		}
+		state = stack.empty() ? DONE : NEXT;
+		return error.empty();
+	}
+
+	bool emit (const char *text, size_t len, bool string, std::string &error)
+	{
+		if (in_key) {
+			key.assign (text, len);
+			in_key = false;
+			state = COLON;
+			return true;
+		}
+		state = stack.empty() ? DONE : NEXT;
+		if (!string && len == 4 && !memcmp (text, "null", 4))
+			return true;
+		top()->value (valueKey(), text, len, error);
+		return error.empty();
+	}
+
+	void appendUnicode (gunichar c)
+	{
+		if (c >= 0xd800 && c <= 0xdbff) {  // wait for the low surrogate
+			flushSurrogate();
+			surrogate = c;
+			return;
+		}
+		if (c >= 0xdc00 && c <= 0xdfff && surrogate)
+			c = 0x10000 + ((surrogate - 0xd800) << 10) + (c - 0xdc00);
+		else {
+			flushSurrogate();
+			if (c >= 0xdc00 && c <= 0xdfff)
+				c = 0xfffd;
+		}
+		surrogate = 0;
+		gchar utf8 [6];
+		buffer.append (utf8, g_unichar_to_utf8 (c, utf8));
+	}
+
+	// a high surrogate not followed by a low one: U+FFFD
+	void flushSurrogate()
+	{
+		if (surrogate)
+			buffer += "\xef\xbf\xbd";
+		surrogate = 0;
+	}
+
+	static bool isLiteral (char c)
+	{ return g_ascii_isalnum (c) || c == '-' || c == '+' || c == '.'; }
+
+	// true, false, null, or a number as json writes them
+	static bool validLiteral (const std::string &text)
+	{
+		if (text == "true" || text == "false" || text == "null")
+			return true;
+		const char *p = text.c_str(), *end = p + text.size();
+		if (p < end && *p == '-')
+			p++;
+		if (p < end && *p == '0')
+			p++;
+		else if (p < end && g_ascii_isdigit (*p))
+			while (p < end && g_ascii_isdigit (*p))
+				p++;
+		else
+			return false;
+		if (p < end && *p == '.') {
+			if (++p == end || !g_ascii_isdigit (*p))
+				return false;
+			while (p < end && g_ascii_isdigit (*p))
+				p++;
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			if (++p < end && (*p == '+' || *p == '-'))
+				p++;
+			if (p == end || !g_ascii_isdigit (*p))
+				return false;
+			while (p < end && g_ascii_isdigit (*p))
+				p++;
+		}
+		return p == end;
+	}
+
+	bool parse (const char *chunk, size_t len, std::string &error)
+	{
+		if (!failure.empty()) {
+			error = failure;
+			return false;
+		}
+		const char *p = chunk, *end = chunk + len;
+		while (p < end) {
+			char c = *p;
+			switch (state) {
+				case STRING: {
+					// bulk of the document: scan for the end in one go
+					if (c != '\\')  // after an escape: already pieced
+						flushSurrogate();
+					const char *s = p;
+					while (p < end && *p != '"' && *p != '\\' && (guchar) *p >= 0x20)
+						p++;
+					if (max_text && buffer.size() + (p-s) > max_text) {
+						gchar *str = g_strdup_printf ("String larger than %lu KB",
+							(unsigned long) max_text / 1024);
+						error = str;
+						g_free (str);
+						break;
+					}
+					if (p == end) {
+						buffer.append (s, p-s);
+						pieced = true;
+						break;
+					}
+					if (*p == '"') {
+						p++;
+						if (!pieced)  // no copy
+							emit (s, p-1 - s, true, error);
+						else {
+							buffer.append (s, p-1 - s);
+							emit (buffer.data(), buffer.size(), true, error);
+						}
+						buffer.clear();
+					}
+					else if (*p == '\\') {
+						buffer.append (s, p-s);
+						pieced = true;
+						p++;
+						state = ESCAPE;
+					}
+					else
+						fail (p, chunk, "control character in string", error);
+					break;
+				}
+				case ESCAPE: {
+					const char *from = "\"\\/bfnrt", *to = "\"\\/\b\f\n\r\t";
+					const char *i = strchr (from, c);
+					if (c == 'u') {
+						unicode = 0;
+						unicode_digits = 0;
+						state = UNICODE;
+					}
+					else if (c && i) {
+						flushSurrogate();
+						buffer += to [i - from];
+						state = STRING;
+					}
+					else
+						fail (p, chunk, "bad escape in string", error);
+					p++;
+					break;
+				}
+				case UNICODE: {
+					int digit = g_ascii_xdigit_value (c);
+					if (digit < 0) {
+						fail (p, chunk, "bad unicode escape in string", error);
+						break;
+					}
+					unicode = unicode * 16 + digit;
+					if (++unicode_digits == 4) {
+						appendUnicode (unicode);
+						state = STRING;
+					}
+					p++;
+					break;
+				}
+				case LITERAL: {
+					const char *s = p;
+					while (p < end && isLiteral (*p))
+						p++;
+					buffer.append (s, p-s);
+					if (p < end) {
+						if (validLiteral (buffer))
+							emit (buffer.data(), buffer.size(), false, error);
+						else
+							fail (p, chunk, "bad literal", error);
+						buffer.clear();
+					}
+					break;
+				}
+				default:
+					if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+						p++;
+						break;
+					}
+					parseStructure (p, chunk, error);
+					break;
+			}
+			if (!error.empty()) {
+				failure = error;
+				return false;
+			}
+		}
+		offset += len;
+		return true;
+	}
+
+	bool finish (std::string &error)
+	{
+		if (!failure.empty()) {
+			error = failure;
+			return false;
+		}
+		// a number has no end of its own
+		if (state == LITERAL && stack.empty() && validLiteral (buffer)) {
+			emit (buffer.data(), buffer.size(), false, error);
+			buffer.clear();
+		}
+		else if (state != DONE) {
+			gchar *str = g_strdup_printf ("JSON error at byte %lu: %s", (unsigned long) offset,
+				state == LITERAL && stack.empty() ? "bad literal" : "document cut short");
+			error = str;
+			g_free (str);
+		}
+		failure = error;
+		return error.empty();
+	}
+
+	// punctuation and the start of values
+	void parseStructure (const char *&p, const char *chunk, std::string &error)
+	{
+		char c = *p;
+		switch (state) {
+			case FIRST_VALUE:
+				if (c == ']') {
+					p++;
+					close (error);
+					return;
+				}
+				// fall through
+			case VALUE:
+				if (c == '{' || c == '[') {
+					p++;
+					open (c == '{', error);
+				}
+				else if (c == '"') {
+					p++;
+					buffer.clear();
+					pieced = false;
+					state = STRING;
+				}
+				else if (isLiteral (c)) {
+					buffer.clear();
+					state = LITERAL;
+				}
+				else
+					fail (p, chunk, "value expected", error);
+				return;
+			case FIRST_MEMBER:
+				if (c == '}') {
+					p++;
+					close (error);
+					return;
+				}
+				// fall through
+			case MEMBER:
+				if (c == '"') {
+					p++;
+					buffer.clear();
+					pieced = false;
+					in_key = true;
+					state = STRING;
+				}
+				else
+					fail (p, chunk, "member name expected", error);
+				return;
+			case COLON:
+				if (c == ':') {
+					p++;
+					state = VALUE;
+				}
+				else
+					fail (p, chunk, "':' expected", error);
+				return;
+			case NEXT: {
+				bool object = stack.back().object;
+				p++;
+				if (c == ',')
+					state = object ? MEMBER : VALUE;
+				else if (c == (object ? '}' : ']'))
+					close (error);
+				else
+					fail (p-1, chunk, object ? "',' or '}' expected" : "',' or ']' expected", error);
+				return;
+			}
+			case DONE:
+				fail (p, chunk, "data after the document", error);
+				return;
+			default:
+				return;
+		}
+	}
+};
+
+JsonParser::JsonParser (JsonParser::Handler *handler)
+: impl (new Impl (handler)) {}
+
+JsonParser::~JsonParser()
+{ delete impl; }
+
+bool JsonParser::parse (const char *text, size_t len, std::string &error_msg)
+{ return impl->parse (text, len, error_msg); }
+
+bool JsonParser::finish (std::string &error_msg)
+{ return impl->finish (error_msg); }
+
+void JsonParser::setLimits (int max_depth, size_t max_text)
+{ impl->max_depth = max_depth; impl->max_text = max_text; }
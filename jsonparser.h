@@ -0,0 +1,43 @@
+// jsonparser.h
+// A streaming json parser, shaped after XmlParser so that json documents
+// (e.g. JSON Feed) can be walked with the same kind of recursive handlers.
+
+#ifndef JSON_PARSER_H
+#define JSON_PARSER_H
+
+#include <string>
+
+struct JsonParser {
+	struct Handler {
+		virtual ~Handler() {}  // children are deleted through it
+		// key is the object member name; elements of an array get the
+		// array's name, and the top value gets NULL
+		virtual Handler *startObject (const char *key, std::string &error) = 0;
+		// strings, numbers and booleans (nulls are skipped); text is only
+		// valid during the call and may point straight into the parsed chunk
+		virtual void value (const char *key, const char *text, size_t len,
+			std::string &error) = 0;
+		virtual void endObject (const char *key, Handler *child,
+			std::string &error) = 0;
+
+		// as with XmlParser, return some other hook on startObject() for
+		// recursive parsing (or 'this') and then the parent gets it on
+		// endObject(); NULL skips the object, with all that is in it
+	};
+
+	JsonParser (Handler *handler);
+	~JsonParser();
+
+	// you may break json text into various calls
+	bool parse (const char *text, size_t len, std::string &error_msg);
+	// once all was given: fails if the document was cut short
+	bool finish (std::string &error_msg);
+
+	// parsing fails beyond these (0 for no limit)
+	void setLimits (int max_depth, size_t max_text);
+
+	struct Impl;
+	Impl *impl;
+};
+
+#endif /*JSON_PARSER_H*/
@@ -2,112 +2,13 @@
 
 #include "parser.h"
 #include "xmlparser.h"
+#include "jsonparser.h"
+#include "charset.h"
 #include <glib.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
-// date-time
-
-static const char *months[] = {
-	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
-	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
-
-static std::string format_date (int year, int month, int day, int hour, int min, int hour_zone, int min_zone)
-{
-	gchar *str;
-	if (min_zone < 0)
-		str = g_strdup_printf ("%s %2d, %d (%02d:%02d ----)",
-			months[month-1], day, year, hour, min);
-	else
-		str = g_strdup_printf ("%s %2d, %d (%02d:%02d %c%02d:%02d)",
-			months[month-1], day, year, hour, min, hour_zone < 0 ? '-' : '+', abs (hour_zone), min_zone);
-	std::string s (str);
-	g_free (str);
-	return s;
-}
-
-static std::string parse_rfc3339 (const std::string &text)  // Atom
-{
-	// spec: http://tools.ietf.org/html/rfc3339#section-5.6
-	if (text.size() < 20)
-		return "";
-	const char *str = text.c_str();
-	int year, month, day, hour, min, hour_zone, min_zone;
-	if (sscanf (str, "%4d-%2d-%2dT%2d:%2d", &year, &month, &day, &hour, &min) == 5) {
-		str = str + 19;
-		if (*str == '.')  // time-secfrac
-			do { ++str;
-			} while (*str != 'Z' && *str != '+' && *str != '-' && *str != '\0');
-		if (*str == '\0')
-			return "";
-		if (*str == 'Z')
-			hour_zone = min_zone = 0;
-		else {
-			sscanf (str+1, "%2d:%2d", &hour_zone, &min_zone);
-			if (*str == '-')
-				hour_zone = -hour_zone;
-		}
-		return format_date (year, month, day, hour, min, hour_zone, min_zone);
-	}
-	return "";
-}
-
-struct Timezone {
-	const char *timezone;
-	int hour;
-};
-Timezone timezones[] = {
-	{ "GMT",  0 }, { "CDT", -5 }, { "CST", -6 }, { "EDT", -4 }, { "EST", -5 },
-	{ "PDT", -7 }, { "PST", -8 },
-};
-static bool timezoneHour (const char *timezone, int *hour)
-{
-	for (unsigned int i = 0; i < sizeof (timezones) / sizeof (Timezone); i++)
-		if (!strncmp (timezone, timezones[i].timezone, 3)) {
-			*hour = timezones[i].hour;
-			return true;
-		}
-	return false;
-}
-
-static std::string parse_rfc822 (const std::string &text)  // RSS
-{
-	// spec: http://asg.web.cmu.edu/rfc/rfc822.html
-	if (text.size() < 26)
-		return "";
-	int year, month, day, hour, min, hour_zone, min_zone;
-	const char *str = text.c_str();
-	str += 5;
-	day = atoi (str);
-	if (isdigit (str[1]))
-		str++;
-	str += 2;
-	for (month = 0; month < 12; month++)
-		if (!strncasecmp (str, months[month], 3))
-			break;
-	if (month == 12)
-		return "";
-	month += 1;
-	str += 4;
-	year = atoi (str);
-	str += 5;
-	hour = atoi (str);
-	str += 3;
-	min = atoi (str);
-	str += 6;
-	if (g_ascii_isdigit (str[1])) {
-		sscanf (str+1, "%2d%2d", &hour_zone, &min_zone);
-		if (*str == '-')
-			hour_zone = -hour_zone;
-	}
-	else if (timezoneHour (str, &hour_zone))
-		min_zone = 0;
-	else
-		min_zone = -1;
-	return format_date (year, month, day, hour, min, hour_zone, min_zone);
-}
-
 //** RSS
 
 struct RssItemParser : public XmlParser::Handler  // <item>
@@ -133,7 +34,8 @@ private:
 		else if (!strcmp (name, "description") || !strcmp (name, "summary") || !strcmp (name, "atom:summary"))
 			handler->setSummary (text);
 		else if (!strcmp (name, "pubDate")) {
-			std::string date (parse_rfc822 (text));
+			Date date;
+			parse_rfc822 (text.c_str(), &date);
 			handler->setDate (date);
 		}
 		else if (!strcmp (name, "author") || !strcmp (name, "dc:creator"))
@@ -185,6 +87,10 @@ private:
 	{
 		if (!strcmp (name, "item")) {
 			ParseNewsHandler *newsHandler = handler->appendNews();
+			if (!newsHandler) {
+				error = "Too many news";
+				return NULL;
+			}
 			return new RssItemParser (newsHandler);
 		}
 		if (!strcmp (name, "image"))
@@ -297,11 +203,13 @@ private:
 		else if (!strcmp (name, "content"))
 			handler->setContent (text);
 		else if (!strcmp (name, "created") || !strcmp (name, "published")) {
-			std::string date (parse_rfc3339 (text));
+			Date date;
+			parse_rfc3339 (text.c_str(), &date);
 			handler->setDate (date);
 		}
 		else if (!strcmp (name, "updated")) {
-			std::string date (parse_rfc3339 (text));
+			Date date;
+			parse_rfc3339 (text.c_str(), &date);
 			handler->setUpdateDate (date, text);
 		}
 		else if (!strcmp (name, "category") || !strcmp (name, "dc:subject"))
@@ -348,8 +256,14 @@ private:
 		const char **attribute_names, const char **attribute_values,
 		std::string &error)
 	{
-		if (!strcmp (name, "entry"))
-			return new AtomEntryParser (handler->appendNews());
+		if (!strcmp (name, "entry")) {
+			ParseNewsHandler *newsHandler = handler->appendNews();
+			if (!newsHandler) {
+				error = "Too many news";
+				return NULL;
+			}
+			return new AtomEntryParser (newsHandler);
+		}
 		else if (!strcmp (name, "author"))
 			return new AtomAuthorParser (handler);
 		else if (!strcmp (name, "link")) {
@@ -410,31 +324,452 @@ private:
 	{ delete child; }
 };
 
-void parse (ParseFeedHandler *handler, const std::string &url,
-            const std::string &codeset, std::string &error_msg)
+//** JSON Feed (spec: http://jsonfeed.org/version/1.1)
+
+struct JsonAuthorParser : public JsonParser::Handler  // "author", "authors"
+{
+	// only one of the handlers is given
+	JsonAuthorParser (ParseFeedHandler *feedHandler, ParseNewsHandler *newsHandler)
+	: feedHandler (feedHandler), newsHandler (newsHandler) {}
+
+private:
+	ParseFeedHandler *feedHandler;
+	ParseNewsHandler *newsHandler;
+
+	virtual JsonParser::Handler *startObject (const char *key, std::string &error)
+	{ return NULL; }
+
+	virtual void value (const char *key, const char *text, size_t len, std::string &error)
+	{
+		if (!strcmp (key, "name")) {
+			if (feedHandler)
+				feedHandler->setAuthor (std::string (text, len));
+			else
+				newsHandler->setAuthor (std::string (text, len));
+		}
+	}
+
+	virtual void endObject (const char *key, JsonParser::Handler *child, std::string &error) {}
+};
+
+struct JsonItemParser : public JsonParser::Handler  // "items"
+{
+	JsonItemParser (ParseNewsHandler *handler)
+	: handler (handler) {}
+
+private:
+	ParseNewsHandler *handler;
+
+	virtual JsonParser::Handler *startObject (const char *key, std::string &error)
+	{
+		if (!strcmp (key, "author") || !strcmp (key, "authors"))
+			return new JsonAuthorParser (NULL, handler);
+		return NULL;
+	}
+
+	virtual void value (const char *key, const char *text, size_t len, std::string &error)
+	{
+		if (!strcmp (key, "title"))
+			handler->setTitle (std::string (text, len));
+		else if (!strcmp (key, "url"))
+			handler->setLink (std::string (text, len));
+		else if (!strcmp (key, "content_html"))
+			handler->setContent (std::string (text, len));
+		else if (!strcmp (key, "content_text") || !strcmp (key, "summary")) {
+			gchar *str = g_markup_escape_text (text, len);  // plain text
+			handler->setSummary (str);
+			g_free (str);
+		}
+		else if (!strcmp (key, "date_published")) {
+			Date date;
+			parse_rfc3339 (std::string (text, len).c_str(), &date);
+			handler->setDate (date);
+		}
+		else if (!strcmp (key, "date_modified")) {
+			std::string str (text, len);
+			Date date;
+			parse_rfc3339 (str.c_str(), &date);
+			handler->setUpdateDate (date, str);
+		}
+		else if (!strcmp (key, "tags"))
+			handler->addCategory (std::string (text, len));
+		else if (!strcmp (key, "id"))
+			handler->setId (std::string (text, len));
+	}
+
+	virtual void endObject (const char *key, JsonParser::Handler *child, std::string &error)
+	{ delete child; }
+};
+
+struct JsonFeedParser : public JsonParser::Handler  // the top object
+{
+	JsonFeedParser (ParseFeedHandler *handler)
+	: versioned (false), handler (handler) {}
+
+	bool versioned;
+
+private:
+	ParseFeedHandler *handler;
+
+	virtual JsonParser::Handler *startObject (const char *key, std::string &error)
+	{
+		if (!strcmp (key, "items")) {
+			ParseNewsHandler *newsHandler = handler->appendNews();
+			if (!newsHandler) {
+				error = "Too many news";
+				return NULL;
+			}
+			return new JsonItemParser (newsHandler);
+		}
+		else if (!strcmp (key, "author") || !strcmp (key, "authors"))
+			return new JsonAuthorParser (handler, NULL);
+		return NULL;
+	}
+
+	virtual void value (const char *key, const char *text, size_t len, std::string &error)
+	{
+		if (!strcmp (key, "version")) {
+			std::string version (text, len);
+			if (version.compare (0, 29, "https://jsonfeed.org/version/") &&
+			    version.compare (0, 28, "http://jsonfeed.org/version/"))
+				error = "Unsupported JSON Feed version: " + version;
+			versioned = true;
+		}
+		else if (!strcmp (key, "title"))
+			handler->setTitle (std::string (text, len));
+		else if (!strcmp (key, "home_page_url"))
+			handler->setLink (std::string (text, len));
+		else if (!strcmp (key, "description"))
+			handler->setDescription (std::string (text, len));
+		else if (!strcmp (key, "icon"))
+			handler->setLogo (std::string (text, len));
+	}
+
+	virtual void endObject (const char *key, JsonParser::Handler *child, std::string &error)
+	{ delete child; }
+};
+
+struct JsonTopParser : public JsonParser::Handler
 {
-	std::string text = download (url, error_msg);
-	if (text.empty()) {
-		if (error_msg.empty())
-			error_msg = "Download failed";
-		return;
+	JsonTopParser (ParseFeedHandler *handler)
+	: found (false), handler (handler) {}
+
+	bool found;  // the feed object
+
+private:
+	ParseFeedHandler *handler;
+
+	// only the top value has no key
+	virtual JsonParser::Handler *startObject (const char *key, std::string &error)
+	{
+		if (key)
+			error = "Unsupported format: JSON array";
+		else {
+			found = true;
+			return new JsonFeedParser (handler);
+		}
+		return NULL;
 	}
-	if (!codeset.empty()) {
-		GError *error = 0;
-		gsize bytes_read, bytes_written;
-		gchar *_text = g_convert (text.c_str(), -1, "utf8", codeset.c_str(),
-		                          &bytes_read, &bytes_written, &error);
-		if (!_text) {
-			error_msg = error->message;
-			g_error_free (error);
-			return;
+
+	virtual void value (const char *key, const char *text, size_t len, std::string &error)
+	{ error = key ? "Unsupported format: JSON array" : "Unsupported format: JSON value"; }
+
+	virtual void endObject (const char *key, JsonParser::Handler *child, std::string &error)
+	{
+		if (!((JsonFeedParser *) child)->versioned)
+			error = "Unsupported format: JSON without a JSON Feed version";
+		delete child;
+	}
+};
+
+//** content sniffing
+
+// leading bytes looked at before deciding what the document is
+#define SNIFF_SIZE 512
+
+// UNSURE_FORMAT: nothing in the head tells, so far
+enum Format { UNKNOWN_FORMAT, UNSURE_FORMAT, XML_FORMAT, HTML_FORMAT, JSON_FORMAT };
+
+static bool starts_with (const char *s, const char *end, const char *prefix)
+{
+	size_t n = strlen (prefix);
+	return (size_t) (end - s) >= n && !g_ascii_strncasecmp (s, prefix, n);
+}
+
+static const char *skip_past (const char *s, const char *end, const char *token)
+{
+	size_t n = strlen (token);
+	for (; s + n <= end; s++)
+		if (!memcmp (s, token, n))
+			return s + n;
+	return NULL;
+}
+
+static Format sniff_format (const char *s, size_t len)
+{
+	const char *end = s + len;
+	if (len >= 2 && ((guchar) s[0] >= 0xfe || !s[0] || !s[1]))
+		return UNSURE_FORMAT;  // utf-16: leave it to the transcoder
+	if (starts_with (s, end, "\xef\xbb\xbf"))
+		s += 3;
+	while (true) {
+		while (s < end && g_ascii_isspace (*s))
+			s++;
+		if (s == end)
+			return UNSURE_FORMAT;
+		if (*s == '{' || *s == '[')
+			return JSON_FORMAT;
+		if (*s != '<')
+			return UNKNOWN_FORMAT;
+
+		if (starts_with (s, end, "<?"))  // declaration, processing instruction
+			s = skip_past (s, end, "?>");
+		else if (starts_with (s, end, "<!--"))
+			s = skip_past (s, end, "-->");
+		else if (starts_with (s, end, "<!doctype")) {
+			const char *t = s + 9;
+			while (t < end && g_ascii_isspace (*t))
+				t++;
+			if (starts_with (t, end, "html"))
+				return HTML_FORMAT;
+			s = skip_past (s, end, ">");
+		}
+		else {  // the root element
+			static const char *html_tags[] = { "html", "head", "body", "script",
+				"meta", "title", "div", "p", "br", "a", "link", "style", 0 };
+			s++;
+			for (int i = 0; html_tags[i]; i++) {
+				const char *t = s + strlen (html_tags[i]);
+				if (starts_with (s, end, html_tags[i]) &&
+				    (t == end || *t == '>' || *t == '/' || g_ascii_isspace (*t)))
+					return HTML_FORMAT;
+			}
+			return XML_FORMAT;
 		}
-		text = _text;
-		g_free (_text);
+		if (!s)
+			return UNSURE_FORMAT;
 	}
+}
 
-	TopParser _handler (handler);
-	XmlParser parser (&_handler);
-	parser.parse (text, error_msg);
+// what the server says the document is, e.g. "application/atom+xml; charset=utf-8"
+static Format content_format (const std::string &content_type)
+{
+	std::string type (content_type, 0, content_type.find_first_of ("; \t"));
+	for (unsigned int i = 0; i < type.size(); i++)
+		type[i] = g_ascii_tolower (type[i]);
+	if (type == "text/html")
+		return HTML_FORMAT;
+	if (type.find ("json") != std::string::npos)  // application/feed+json, text/json...
+		return JSON_FORMAT;
+	if (type == "text/xml" || type == "application/xml" ||
+	    (!type.compare (0, 12, "application/") && type.size() > 16 &&
+	     !type.compare (type.size()-4, 4, "+xml")))
+		return XML_FORMAT;
+	return UNKNOWN_FORMAT;
 }
 
+// contents of <title>, to tell the user what the page was about
+static std::string html_title (const char *s, size_t len)
+{
+	const char *end = s + len;
+	for (; s < end; s++)
+		if (starts_with (s, end, "<title")) {
+			s = skip_past (s, end, ">");
+			const char *e = s ? skip_past (s, end, "<") : NULL;
+			if (!e)
+				break;
+			std::string title (s, e-1 - s);
+			title = title.substr (0, utf8_valid_prefix (title.data(), title.size()));
+			for (unsigned int i = 0; i < title.size(); i++)
+				if (g_ascii_isspace (title[i]))
+					title[i] = ' ';
+			std::string::size_type i = title.find_first_not_of (' ');
+			std::string::size_type j = title.find_last_not_of (' ');
+			if (i == std::string::npos)
+				break;
+			title = title.substr (i, j-i+1);
+			if (title.size() > 80)
+				title = title.substr (0, utf8_valid_prefix (title.data(), 77)) + "...";
+			return title;
+		}
+	return "";
+}
+
+// text is parsed as it arrives, so the document is never held in memory;
+// the limits are checked along the way, aborting the transfer
+struct FeedStream : public Transcoder::Sink, ParseFeedHandler
+{
+	FeedStream (ParseFeedHandler *handler, const std::string &codeset,
+	            const ParseLimits &limits)
+	: handler (handler), limits (limits), top (this), parser (&top),
+	  json_top (this), json_parser (&json_top), transcoder (this, codeset),
+	  received (0), items (0), status (0), sniffed (false), format (UNKNOWN_FORMAT)
+	{
+		parser.setLimits (limits.max_depth, limits.max_text);
+		json_parser.setLimits (limits.max_depth, limits.max_text);
+	}
+
+	ParseFeedHandler *handler;
+	const ParseLimits &limits;
+	TopParser top;
+	XmlParser parser;
+	JsonTopParser json_top;
+	JsonParser json_parser;
+	Transcoder transcoder;
+	std::string error, limit_error;
+	size_t received;
+	int items;
+	// held back until we know it's a feed
+	std::string head, content_type;
+	int status;
+	bool sniffed;
+	Format format;
+
+	// false if the head of the document doesn't look like a feed; the
+	// Content-Type decides only what the head leaves open
+	bool sniff (std::string &error)
+	{
+		sniffed = true;
+		format = sniff_format (head.data(), head.size());
+		if (format == UNSURE_FORMAT) {
+			Format said = content_format (content_type);
+			format = said == UNKNOWN_FORMAT ? XML_FORMAT : said;  // unsaid: the parser will tell
+		}
+		if (format == XML_FORMAT || format == JSON_FORMAT)
+			return true;
+
+		std::string why;
+		if (status >= 400) {
+			gchar *str = g_strdup_printf ("HTTP %d", status);
+			why = str;
+			g_free (str);
+		}
+		else if (!content_type.empty())
+			why = content_type;
+		if (!why.empty())
+			why = " (" + why + ")";
+
+		if (format == HTML_FORMAT) {
+			error = "Server sent a web page instead of a feed" + why;
+			std::string title = html_title (head.data(), head.size());
+			if (!title.empty())
+				error += ": \"" + title + "\"";
+		}
+		else
+			error = "Server sent something other than a feed" + why;
+		return false;
+	}
+
+	bool flushHead (std::string &error)
+	{
+		if (!sniff (error))
+			return false;
+		bool ret = transcoder.write (head.data(), head.size(), error);
+		head.clear();
+		return ret;
+	}
+
+	virtual bool write (const char *text, size_t len, std::string &error)
+	{
+		bool ok;
+		if (format == JSON_FORMAT)
+			ok = json_parser.parse (text, len, error);
+		else
+			ok = parser.parse (text, len, error);
+		if (ok)
+			return true;
+		if (!limit_error.empty())
+			error = limit_error;
+		return false;
+	}
+
+	static size_t write_cb (char *buffer, size_t size, size_t nitems, void *data)
+	{
+		FeedStream *pThis = (FeedStream *) data;
+		size_t len = size * nitems;
+		pThis->received += len;
+		if (pThis->limits.max_body && pThis->received > pThis->limits.max_body) {
+			gchar *str = g_strdup_printf ("Feed is larger than %lu KB: gave up",
+				(unsigned long) pThis->limits.max_body / 1024);
+			pThis->error = str;
+			g_free (str);
+			return 0;  // abort transfer
+		}
+		if (!pThis->sniffed) {
+			pThis->head.append (buffer, len);
+			if (pThis->head.size() >= SNIFF_SIZE && !pThis->flushHead (pThis->error))
+				return 0;
+			return len;
+		}
+		if (!pThis->transcoder.write (buffer, len, pThis->error))
+			return 0;
+		return len;
+	}
+
+	static size_t header_cb (char *buffer, size_t size, size_t nitems, void *data)
+	{
+		FeedStream *pThis = (FeedStream *) data;
+		size_t len = size * nitems;
+		std::string line (buffer, len);
+		std::string::size_type i = line.find_last_not_of (" \t\r\n");
+		line.erase (i == std::string::npos ? 0 : i+1);
+		if (!line.compare (0, 5, "HTTP/")) {  // status line, one per redirect
+			i = line.find (' ');
+			pThis->status = i == std::string::npos ? 0 : atoi (line.c_str() + i+1);
+			// the headers of the response before are no longer of use
+			pThis->content_type.clear();
+			pThis->transcoder.setContentType ("");
+		}
+		else if (!g_ascii_strncasecmp (line.c_str(), "Content-Type:", 13)) {
+			i = line.find_first_not_of (" \t", 13);
+			pThis->content_type = i == std::string::npos ? "" : line.substr (i);
+			pThis->transcoder.setContentType (pThis->content_type);
+		}
+		return len;
+	}
+
+	// ParseFeedHandler: just counts the news
+	virtual void setTitle (const std::string &title)
+	{ handler->setTitle (title); }
+	virtual void setDescription (const std::string &description)
+	{ handler->setDescription (description); }
+	virtual void setLink (const std::string &link)
+	{ handler->setLink (link); }
+	virtual void setAuthor (const std::string &author)
+	{ handler->setAuthor (author); }
+	virtual void setLogo (const std::string &logo)
+	{ handler->setLogo (logo); }
+	virtual ParseNewsHandler *appendNews()
+	{
+		if (limits.max_items && ++items > limits.max_items) {
+			gchar *str = g_strdup_printf ("Feed has more than %d news: gave up",
+				limits.max_items);
+			limit_error = str;
+			g_free (str);
+			return NULL;
+		}
+		return handler->appendNews();
+	}
+};
+
+void parse (ParseFeedHandler *handler, const std::string &url,
+            const std::string &codeset, const ParseLimits &limits,
+            std::string &error_msg)
+{
+	FeedStream stream (handler, codeset, limits);
+	// JSON Feed is the cheapest for both ends, when the server has it
+	bool ok = download (url, FeedStream::write_cb, FeedStream::header_cb,
+	                    &stream, stream.error, "application/feed+json, "
+	                    "application/atom+xml;q=0.9, application/rss+xml;q=0.9, "
+	                    "application/xml;q=0.8, text/xml;q=0.8, */*;q=0.5");
+	if (ok && !stream.received)
+		stream.error = "Download failed";
+	if (ok && stream.error.empty() && !stream.sniffed)  // short document
+		stream.flushHead (stream.error);
+	if (ok && stream.error.empty())
+		stream.transcoder.close (stream.error);
+	if (ok && stream.error.empty() && stream.format == JSON_FORMAT &&
+	    stream.json_parser.finish (stream.error) && !stream.json_top.found)
+		stream.error = "Unsupported format: JSON array";
+	error_msg = stream.error;
+}
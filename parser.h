@@ -4,6 +4,7 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "date.h"
 #include <string>
 
 struct ParseNewsHandler
@@ -12,8 +13,8 @@ struct ParseNewsHandler
 	virtual void setSummary (const std::string &summary) = 0;
 	virtual void setContent (const std::string &content) = 0;
 	virtual void setLink (const std::string &link) = 0;
-	virtual void setDate (const std::string &date) = 0;
-	virtual void setUpdateDate (const std::string &date, const std::string &id) = 0;
+	virtual void setDate (const Date &date) = 0;
+	virtual void setUpdateDate (const Date &date, const std::string &id) = 0;
 	virtual void setAuthor (const std::string &author) = 0;
 	virtual void addCategory (const std::string &category) = 0;
 	virtual void setId (const std::string &id) = 0;
@@ -26,11 +27,24 @@ struct ParseFeedHandler
 	virtual void setLink (const std::string &link) = 0;
 	virtual void setAuthor (const std::string &author) = 0;
 	virtual void setLogo (const std::string &logo) = 0;
-	virtual ParseNewsHandler *appendNews() = 0;
+	virtual ParseNewsHandler *appendNews() = 0;  // NULL stops the parsing
+};
+
+// bounds on what a single feed may cost us (0 for no limit)
+struct ParseLimits
+{
+	size_t max_body;   // bytes downloaded
+	int max_depth;     // element nesting
+	size_t max_text;   // bytes of a single text node
+	int max_items;     // news
+
+	ParseLimits()
+	: max_body (8 << 20), max_depth (64), max_text (1 << 20), max_items (2000) {}
 };
 
 void parse (ParseFeedHandler *handler, const std::string &url,
-            const std::string &codeset, std::string &error_msg);
+            const std::string &codeset, const ParseLimits &limits,
+            std::string &error_msg);
 
 #endif /*PARSER_H*/
 
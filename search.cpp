@@ -0,0 +1,166 @@
+// search.cpp
+
+#include "search.h"
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+
+#define MAX_WORD 32  // in chars; longer ones are not words
+
+SearchIndex::SearchIndex()
+: docs (1, (gpointer) NULL), removed (0)
+{}
+
+void SearchIndex::Postings::append (guint32 doc)
+{
+	guint32 delta = doc - last;
+	while (delta >= 0x80) {
+		data += (char) (delta | 0x80);
+		delta >>= 7;
+	}
+	data += (char) delta;
+	last = doc;
+}
+
+static void decode (const std::string &data, std::vector <guint32> *docs)
+{
+	guint32 doc = 0, delta = 0;
+	int shift = 0;
+	for (unsigned int i = 0; i < data.size(); i++) {
+		guchar c = data[i];
+		delta |= (guint32) (c & 0x7f) << shift;
+		if (c & 0x80)
+			shift += 7;
+		else {
+			doc += delta;
+			docs->push_back (doc);
+			delta = 0;
+			shift = 0;
+		}
+	}
+}
+
+void SearchIndex::split (const std::string &text, std::vector <std::string> *words)
+{
+	const gchar *p = text.c_str(), *end = p + text.size();
+	std::string word;
+	int chars = 0;
+	while (p <= end) {
+		gunichar c = p < end ? g_utf8_get_char_validated (p, end - p) : 0;
+		if (c == (gunichar) -1 || c == (gunichar) -2) {  // not utf-8
+			p++;
+			continue;
+		}
+		if (g_unichar_isalnum (c)) {
+			if (chars++ < MAX_WORD) {
+				gchar buf[6];
+				word.append (buf, g_unichar_to_utf8 (g_unichar_tolower (c), buf));
+			}
+		}
+		else {
+			if (chars >= 2 && chars <= MAX_WORD)
+				words->push_back (word);
+			word.clear();
+			chars = 0;
+			if (c == '<') {  // markup
+				const gchar *close = (const gchar *) memchr (p, '>', end - p);
+				p = close ? close : end;
+			}
+			else if (c == '&') {  // entity
+				const gchar *semicolon = (const gchar *) memchr (p, ';', MIN (end - p, 10));
+				if (semicolon)
+					p = semicolon;
+			}
+		}
+		if (p == end)
+			break;
+		p = g_utf8_next_char (p);
+	}
+}
+
+guint32 SearchIndex::add (gpointer data, const std::string &text,
+                          const std::vector <std::string> &keys)
+{
+	guint32 doc = docs.size();
+	docs.push_back (data);
+	std::vector <std::string> words (keys);
+	split (text, &words);
+	std::sort (words.begin(), words.end());
+	words.erase (std::unique (words.begin(), words.end()), words.end());
+	for (std::vector <std::string>::const_iterator it = words.begin(); it != words.end(); it++)
+		terms[*it].append (doc);
+	return doc;
+}
+
+void SearchIndex::remove (guint32 doc)
+{
+	if (doc < docs.size() && docs[doc]) {
+		docs[doc] = NULL;
+		removed++;
+	}
+}
+
+void SearchIndex::replace (guint32 doc, gpointer data)
+{
+	if (doc < docs.size() && docs[doc])
+		docs[doc] = data;
+}
+
+void SearchIndex::clear()
+{
+	terms.clear();
+	docs.assign (1, (gpointer) NULL);
+	removed = 0;
+}
+
+bool SearchIndex::wasteful() const
+{ return removed > 4096 && removed * 2 > docs.size(); }
+
+void SearchIndex::lookup (const std::string &key, std::vector <gpointer> *results) const
+{
+	std::map <std::string, Postings>::const_iterator term = terms.find (key);
+	if (term == terms.end())
+		return;
+	std::vector <guint32> matches;
+	decode (term->second.data, &matches);
+	for (std::vector <guint32>::reverse_iterator it = matches.rbegin();
+	     it != matches.rend(); it++)
+		if (docs[*it])
+			results->push_back (docs[*it]);
+}
+
+static bool fewer_docs (const std::string *a, const std::string *b)
+{ return a->size() < b->size(); }
+
+void SearchIndex::search (const std::string &query, std::vector <gpointer> *results) const
+{
+	std::vector <std::string> words;
+	split (query, &words);
+	if (words.empty())
+		return;
+
+	// intersect starting with the shortest list: the others only filter it
+	std::vector <const std::string *> lists;
+	for (std::vector <std::string>::const_iterator it = words.begin(); it != words.end(); it++) {
+		std::map <std::string, Postings>::const_iterator term = terms.find (*it);
+		if (term == terms.end())
+			return;
+		lists.push_back (&term->second.data);
+	}
+	std::sort (lists.begin(), lists.end(), fewer_docs);
+	std::vector <guint32> matches, other, both;
+	decode (*lists[0], &matches);
+	for (unsigned int i = 1; i < lists.size() && !matches.empty(); i++) {
+		other.clear();
+		decode (*lists[i], &other);
+		both.clear();
+		std::set_intersection (matches.begin(), matches.end(),
+			other.begin(), other.end(), std::back_inserter (both));
+		matches.swap (both);
+	}
+
+	for (std::vector <guint32>::reverse_iterator it = matches.rbegin();
+	     it != matches.rend(); it++)
+		if (docs[*it])
+			results->push_back (docs[*it]);
+}
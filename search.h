@@ -0,0 +1,49 @@
+// search.h
+// inverted index of words to the documents (news) they appear in
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <glib.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class SearchIndex
+{
+public:
+	SearchIndex();
+
+	// text may have html markup, which isn't indexed; keys are taken as
+	// they are, for lookup(); returns the document number, never 0
+	guint32 add (gpointer data, const std::string &text,
+	             const std::vector <std::string> &keys = std::vector <std::string>());
+	void remove (guint32 doc);
+	void replace (guint32 doc, gpointer data);  // same text, other data
+	void clear();
+
+	// documents with all the words of the query, the latest added first
+	void search (const std::string &query, std::vector <gpointer> *results) const;
+	void lookup (const std::string &key, std::vector <gpointer> *results) const;
+
+	// removed documents are still in the postings, only skipped over;
+	// when they are most of it, clear() and add the others again
+	bool wasteful() const;
+
+	// lower-cased words of 2 chars or more
+	static void split (const std::string &text, std::vector <std::string> *words);
+
+private:
+	// document numbers in increasing order, as variable length deltas
+	struct Postings {
+		std::string data;
+		guint32 last;
+		Postings() : last (0) {}
+		void append (guint32 doc);
+	};
+	std::map <std::string, Postings> terms;
+	std::vector <gpointer> docs;  // by number; NULL when removed
+	guint32 removed;
+};
+
+#endif /*SEARCH_H*/
@@ -0,0 +1,204 @@
+// snapshot.cpp
+
+#include "snapshot.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAGIC "EFSTATE\n"
+#define VERSION 3
+
+static inline size_t align8 (size_t n)
+{ return (n + 7) & ~(size_t) 7; }
+
+Snapshot::Snapshot()
+: data (NULL), size (0), header (NULL), records (NULL), folders (NULL), pool (NULL)
+{}
+
+Snapshot::~Snapshot()
+{
+	if (data)
+		munmap (data, size);
+}
+
+bool Snapshot::map (const std::string &path, std::string &error)
+{
+	int fd = open (path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			error = "couldn't open " + path + ": " + g_strerror (errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat (fd, &st) == 0 && st.st_size >= (off_t) sizeof (Header)) {
+		size = st.st_size;
+		void *p = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		data = p == MAP_FAILED ? NULL : (char *) p;
+	}
+	close (fd);
+	if (!data) {
+		error = path + " couldn't be mapped";
+		return false;
+	}
+
+	// check whatever could make us read out of the mapping
+	header = (const Header *) data;
+	guint64 records_end = sizeof (Header) + (guint64) header->feeds_nb * sizeof (Record) +
+		(guint64) header->folders_nb * sizeof (FolderRecord);
+	bool ok = !memcmp (header->magic, MAGIC, 8) && header->version == VERSION &&
+		records_end <= header->pool_offset && header->pool_size > 0 &&
+		header->pool_offset + header->pool_size <= size &&
+		data [header->pool_offset + header->pool_size - 1] == '\0';
+	if (ok) {
+		records = (const Record *) (data + sizeof (Header));
+		folders = (const FolderRecord *) (records + header->feeds_nb);
+		pool = data + header->pool_offset;
+		IdSet read;  // the flags must make tables it can attach
+		for (guint32 i = 0; i < header->feeds_nb && ok; i++) {
+			const Record &r = records[i];
+			ok = r.url < header->pool_size && r.title < header->pool_size &&
+				r.codeset < header->pool_size && r.read_offset % 8 == 0 &&
+				r.read_offset <= size && r.read_slots <= (size - r.read_offset) / 8 &&
+				r.folder >= -1 && r.folder < (gint32) header->folders_nb &&
+				read.attach ((const guint64 *) (data + r.read_offset), r.read_slots, r.read_nb);
+		}
+		for (guint32 i = 0; i < header->folders_nb && ok; i++)
+			ok = folders[i].name < header->pool_size;
+	}
+	if (!ok) {
+		error = path + " is not a state snapshot of this version";
+		munmap (data, size);
+		data = NULL;
+		header = NULL;
+		return false;
+	}
+	return true;
+}
+
+void Snapshot::getLimits (ParseLimits *limits) const
+{
+	limits->max_body = header->max_body;
+	limits->max_depth = header->max_depth;
+	limits->max_text = header->max_text;
+	limits->max_items = header->max_items;
+}
+
+void Snapshot::getRetention (Retention *retention) const
+{
+	*retention = Retention (header->keep_days, header->keep_items, header->keep_unread);
+}
+
+int Snapshot::feedsNb() const
+{ return header ? header->feeds_nb : 0; }
+
+const char *Snapshot::feedUrl (int nb) const
+{ return pool + records[nb].url; }
+const char *Snapshot::feedTitle (int nb) const
+{ return pool + records[nb].title; }
+const char *Snapshot::feedCodeset (int nb) const
+{ return pool + records[nb].codeset; }
+Retention Snapshot::feedRetention (int nb) const
+{
+	const Record &r = records[nb];
+	return Retention (r.keep_days, r.keep_items, r.keep_unread);
+}
+int Snapshot::feedFolder (int nb) const
+{ return records[nb].folder; }
+
+bool Snapshot::attachRead (int nb, IdSet *read) const
+{
+	const Record &r = records[nb];
+	return read->attach ((const guint64 *) (data + r.read_offset), r.read_slots, r.read_nb);
+}
+
+int Snapshot::foldersNb() const
+{ return header ? header->folders_nb : 0; }
+
+const char *Snapshot::folderName (int nb) const
+{ return pool + folders[nb].name; }
+int Snapshot::folderRefresh (int nb) const
+{ return folders[nb].refresh; }
+bool Snapshot::folderExpanded (int nb) const
+{ return folders[nb].expanded; }
+
+// Builder
+
+Snapshot::Builder::Builder (const ParseLimits &limits, const Retention &retention)
+: limits (limits), retention (retention)
+{}
+
+guint32 Snapshot::Builder::addString (const std::string &str)
+{
+	guint32 offset = pool.size();
+	pool += str;
+	pool += '\0';
+	return offset;
+}
+
+void Snapshot::Builder::addFeed (const std::string &url, const std::string &title,
+                                 const std::string &codeset, const Retention &retention,
+                                 const IdSet &read, int folder)
+{
+	Record r;
+	memset (&r, 0, sizeof (r));
+	r.url = addString (url);
+	r.title = addString (title);
+	r.codeset = addString (codeset);
+	r.keep_days = retention.max_days;
+	r.keep_items = retention.max_items;
+	r.keep_unread = retention.keep_unread;
+	r.folder = folder;
+	r.read_offset = tables.size();  // relative, until finish()
+	r.read_slots = read.tableSize();
+	r.read_nb = read.size();
+	tables.append ((const char *) read.table(), read.tableSize() * sizeof (guint64));
+	records.push_back (r);
+}
+
+void Snapshot::Builder::addFolder (const std::string &name, int refresh, bool expanded)
+{
+	FolderRecord r;
+	memset (&r, 0, sizeof (r));
+	r.name = addString (name);
+	r.refresh = refresh;
+	r.expanded = expanded;
+	folders.push_back (r);
+}
+
+void Snapshot::Builder::finish (std::string *data)
+{
+	Header header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, MAGIC, 8);
+	header.version = VERSION;
+	header.feeds_nb = records.size();
+	header.max_body = limits.max_body;
+	header.max_text = limits.max_text;
+	header.max_depth = limits.max_depth;
+	header.max_items = limits.max_items;
+	header.keep_days = retention.max_days;
+	header.keep_items = retention.max_items;
+	header.keep_unread = retention.keep_unread;
+	header.folders_nb = folders.size();
+	if (pool.empty())
+		pool += '\0';
+	header.pool_offset = sizeof (Header) + records.size() * sizeof (Record) +
+		folders.size() * sizeof (FolderRecord);
+	header.pool_size = pool.size();
+	guint64 tables_offset = align8 (header.pool_offset + pool.size());
+	for (unsigned int i = 0; i < records.size(); i++)
+		records[i].read_offset += tables_offset;
+
+	data->reserve (tables_offset + tables.size());
+	data->assign ((const char *) &header, sizeof (header));
+	if (!records.empty())
+		data->append ((const char *) &records[0], records.size() * sizeof (Record));
+	if (!folders.empty())
+		data->append ((const char *) &folders[0], folders.size() * sizeof (FolderRecord));
+	*data += pool;
+	data->resize (tables_offset, '\0');
+	*data += tables;
+}
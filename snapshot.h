@@ -0,0 +1,91 @@
+// snapshot.h
+// binary image of the subscriptions and their read flags, mapped at startup
+// and read in place
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "parser.h"
+#include "store.h"
+#include "idset.h"
+#include <glib.h>
+#include <string>
+#include <vector>
+
+class Snapshot
+{
+	// file: header, a record per feed, one per folder, a pool of
+	// nul-terminated strings, and the IdSet tables of the read flags; all
+	// 8 bytes aligned
+	struct Header {
+		char magic[8];
+		guint32 version, feeds_nb;
+		guint64 max_body, max_text;
+		guint32 max_depth, max_items;
+		gint32 keep_days, keep_items, keep_unread;
+		guint32 folders_nb;
+		guint64 pool_offset, pool_size;
+	};
+	struct Record {
+		guint32 url, title, codeset;  // in the pool
+		gint32 keep_days, keep_items, keep_unread;
+		gint32 folder, unused;  // -1 for none
+		guint64 read_offset, read_slots, read_nb;
+	};
+	struct FolderRecord {
+		guint32 name;  // in the pool
+		gint32 refresh;
+		guint32 expanded, unused;
+	};
+
+public:
+	Snapshot();
+	~Snapshot();
+
+	// false if there is none, or it can't be used (error then says why)
+	bool map (const std::string &path, std::string &error);
+
+	void getLimits (ParseLimits *limits) const;
+	void getRetention (Retention *retention) const;
+	int feedsNb() const;
+	const char *feedUrl (int nb) const;
+	const char *feedTitle (int nb) const;
+	const char *feedCodeset (int nb) const;
+	Retention feedRetention (int nb) const;
+	int feedFolder (int nb) const;  // -1 for none
+	// the set uses the mapped flags until changed
+	bool attachRead (int nb, IdSet *read) const;
+
+	int foldersNb() const;
+	const char *folderName (int nb) const;
+	int folderRefresh (int nb) const;
+	bool folderExpanded (int nb) const;
+
+	class Builder {
+	public:
+		Builder (const ParseLimits &limits, const Retention &retention);
+		void addFeed (const std::string &url, const std::string &title,
+		              const std::string &codeset, const Retention &retention,
+		              const IdSet &read, int folder = -1);
+		void addFolder (const std::string &name, int refresh, bool expanded);
+		void finish (std::string *data);  // the file contents
+
+	private:
+		std::string pool, tables;
+		std::vector <Record> records;
+		std::vector <FolderRecord> folders;
+		ParseLimits limits;
+		Retention retention;
+		guint32 addString (const std::string &str);
+	};
+
+private:
+	char *data;
+	size_t size;
+	const Header *header;
+	const Record *records;
+	const FolderRecord *folders;
+	const char *pool;
+};
+
+#endif /*SNAPSHOT_H*/
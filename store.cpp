@@ -0,0 +1,428 @@
+// store.cpp
+
+#include "store.h"
+#include <glib/gstdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// log: a header, then records of
+//   key length (4 bytes), data length (4), checksum (4), key, data
+// a record with no data removes the key
+#define LOG_MAGIC "EFLOG01\n"
+#define INDEX_MAGIC "EFIDX01\n"
+#define MAGIC_SIZE 8
+#define RECORD_HEADER 12
+
+guint32 Store::checksum (const char *data, size_t len, guint32 hash)
+{
+	// FNV-1a
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ (guchar) data[i]) * 16777619u;
+	return hash;
+}
+
+static bool read_all (int fd, guint64 offset, char *buffer, size_t len)
+{
+	while (len) {
+		ssize_t n = pread (fd, buffer, len, offset);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return false;
+		}
+		buffer += n; len -= n; offset += n;
+	}
+	return true;
+}
+
+static bool write_all (int fd, const char *buffer, size_t len)
+{
+	while (len) {
+		ssize_t n = write (fd, buffer, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buffer += n; len -= n;
+	}
+	return true;
+}
+
+static std::string errno_msg (const std::string &what)
+{ return what + ": " + g_strerror (errno); }
+
+Retention Retention::over (const Retention &global) const
+{
+	return Retention (max_days < 0 ? global.max_days : max_days,
+		max_items < 0 ? global.max_items : max_items,
+		keep_unread < 0 ? global.keep_unread : keep_unread);
+}
+
+// encoding
+
+void Store::Writer::putInt (gint64 value)
+{ data.append ((const char *) &value, sizeof (value)); }
+
+void Store::Writer::putString (const char *str, size_t len)
+{
+	guint32 _len = len;
+	data.append ((const char *) &_len, sizeof (_len));
+	data.append (str, len);
+}
+
+void Store::Writer::putDate (const Date &date)
+{
+	putInt (date.time);
+	putInt ((gint64) date.zone * 256 + date.flags);
+}
+
+Store::Reader::Reader (const std::string &data)
+: p (data.data()), end (data.data() + data.size()), failed (false)
+{}
+
+bool Store::Reader::getInt (gint64 *value)
+{
+	if (failed || end - p < (ssize_t) sizeof (*value))
+		return !(failed = true);
+	memcpy (value, p, sizeof (*value));
+	p += sizeof (*value);
+	return true;
+}
+
+bool Store::Reader::getString (std::string *str)
+{
+	const char *s;
+	size_t len;
+	if (!getString (&s, &len))
+		return false;
+	str->assign (s, len);
+	return true;
+}
+
+bool Store::Reader::getString (const char **str, size_t *len)
+{
+	guint32 _len;
+	if (failed || end - p < (ssize_t) sizeof (_len))
+		return !(failed = true);
+	memcpy (&_len, p, sizeof (_len));
+	p += sizeof (_len);
+	if ((size_t) (end - p) < _len)
+		return !(failed = true);
+	*str = p;
+	*len = _len;
+	p += _len;
+	return true;
+}
+
+bool Store::Reader::getDate (Date *date)
+{
+	gint64 time, rest;
+	if (!getInt (&time) || !getInt (&rest))
+		return false;
+	date->time = time;
+	date->flags = rest & 0xff;
+	date->zone = (rest - date->flags) / 256;
+	return true;
+}
+
+// Store
+
+Store::Store (const std::string &dir)
+: dir (dir), fd (-1), log_size (0), compact_fd (-1), compact_from (0), compact_size (0)
+{}
+
+Store::~Store()
+{
+	compactAbort();
+	if (fd >= 0)
+		close (fd);
+}
+
+bool Store::open (std::string &error)
+{
+	if (g_mkdir_with_parents (dir.c_str(), 0700)) {
+		error = errno_msg ("couldn't create " + dir);
+		return false;
+	}
+	std::string log = dir + "/news.log";
+	fd = ::open (log.c_str(), O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		error = errno_msg ("couldn't open " + log);
+		return false;
+	}
+	guint64 size = lseek (fd, 0, SEEK_END);
+	if (size == 0) {
+		if (!write_all (fd, LOG_MAGIC, MAGIC_SIZE)) {
+			error = errno_msg ("couldn't write " + log);
+			return false;
+		}
+		log_size = MAGIC_SIZE;
+		return true;
+	}
+	char magic [MAGIC_SIZE];
+	if (!read_all (fd, 0, magic, MAGIC_SIZE) || memcmp (magic, LOG_MAGIC, MAGIC_SIZE)) {
+		error = log + " is not a news log";
+		close (fd);
+		fd = -1;
+		return false;
+	}
+
+	if (!readIndex() || log_size > size) {
+		index.clear();
+		log_size = MAGIC_SIZE;
+	}
+	// pick up what the index missed; cut a record left half-written
+	guint64 end = scan (log_size);
+	if (end < size && ftruncate (fd, end) != 0) {
+		error = errno_msg ("couldn't truncate " + log);
+		return false;
+	}
+	log_size = end;
+	lseek (fd, log_size, SEEK_SET);
+	return true;
+}
+
+guint64 Store::scan (guint64 offset)
+{
+	char header [RECORD_HEADER];
+	std::string key, data;
+	while (read_all (fd, offset, header, RECORD_HEADER)) {
+		guint32 key_len, data_len, sum;
+		memcpy (&key_len, header, 4);
+		memcpy (&data_len, header + 4, 4);
+		memcpy (&sum, header + 8, 4);
+		key.resize (key_len);
+		data.resize (data_len);
+		guint64 data_offset = offset + RECORD_HEADER + key_len;
+		if ((key_len && !read_all (fd, offset + RECORD_HEADER, &key[0], key_len)) ||
+		    (data_len && !read_all (fd, data_offset, &data[0], data_len)))
+			break;
+		if (checksum (data.data(), data_len, checksum (key.data(), key_len)) != sum)
+			break;
+		if (data_len) {
+			Entry entry = { data_offset, data_len };
+			index[key] = entry;
+		}
+		else
+			index.erase (key);
+		offset = data_offset + data_len;
+	}
+	return offset;
+}
+
+bool Store::load (const std::string &key, std::string *batch)
+{
+	std::map <std::string, Entry>::const_iterator it = index.find (key);
+	if (fd < 0 || it == index.end())
+		return false;
+	batch->resize (it->second.length);
+	return read_all (fd, it->second.offset, &(*batch)[0], it->second.length);
+}
+
+void Store::put (const std::string &key, const std::string &batch)
+{ queue.push_back (std::make_pair (key, batch)); }
+
+void Store::remove (const std::string &key)
+{ queue.push_back (std::make_pair (key, std::string())); }
+
+bool Store::flush (std::string &error)
+{
+	if (fd < 0 || queue.empty()) {
+		queue.clear();
+		return true;
+	}
+	std::string buffer;
+	for (unsigned int i = 0; i < queue.size(); i++) {
+		const std::string &key = queue[i].first, &data = queue[i].second;
+		guint32 header[3] = { (guint32) key.size(), (guint32) data.size(),
+			checksum (data.data(), data.size(), checksum (key.data(), key.size())) };
+		guint64 offset = log_size + buffer.size() + RECORD_HEADER + key.size();
+		buffer.append ((const char *) header, RECORD_HEADER);
+		buffer += key;
+		buffer += data;
+		if (data.empty())
+			index.erase (key);
+		else {
+			Entry entry = { offset, (guint32) data.size() };
+			index[key] = entry;
+		}
+	}
+	queue.clear();
+
+	if (!write_all (fd, buffer.data(), buffer.size()) || fdatasync (fd) != 0) {
+		error = errno_msg ("couldn't write the news log");
+		// whatever made it is found again by scan() next time
+		index.clear();
+		log_size = MAGIC_SIZE;
+		log_size = scan (log_size);
+		lseek (fd, log_size, SEEK_SET);
+		return false;
+	}
+	log_size += buffer.size();
+	return writeIndex (error);
+}
+
+// index: a header, the log size covered (8 bytes), then entries of
+//   key length (4), key, offset (8), length (4)
+
+bool Store::readIndex()
+{
+	gchar *contents;
+	gsize len;
+	std::string path = dir + "/news.idx";
+	if (!g_file_get_contents (path.c_str(), &contents, &len, NULL))
+		return false;
+	std::string data (contents, len);
+	g_free (contents);
+
+	if (data.compare (0, MAGIC_SIZE, INDEX_MAGIC))
+		return false;
+	std::string body (data, MAGIC_SIZE);
+	Reader reader (body);
+	gint64 covered;
+	if (!reader.getInt (&covered))
+		return false;
+	std::map <std::string, Entry> entries;
+	std::string key;
+	while (reader.getString (&key)) {
+		gint64 offset, length;
+		if (!reader.getInt (&offset) || !reader.getInt (&length))
+			return false;
+		Entry entry = { (guint64) offset, (guint32) length };
+		entries[key] = entry;
+	}
+	index.swap (entries);
+	log_size = covered;
+	return true;
+}
+
+bool Store::writeIndex (std::string &error)
+{
+	Writer writer;
+	writer.data = INDEX_MAGIC;
+	writer.putInt (log_size);
+	for (std::map <std::string, Entry>::const_iterator it = index.begin();
+	     it != index.end(); it++) {
+		writer.putString (it->first);
+		writer.putInt (it->second.offset);
+		writer.putInt (it->second.length);
+	}
+	// g_file_set_contents() writes aside and renames over, so there is
+	// always a whole index
+	std::string path = dir + "/news.idx";
+	GError *err = NULL;
+	if (!g_file_set_contents (path.c_str(), writer.data.data(), writer.data.size(), &err)) {
+		error = err->message;
+		g_error_free (err);
+		return false;
+	}
+	return true;
+}
+
+// compaction
+
+#define MIN_COMPACT (1 << 20)  // log size worth the trouble
+
+bool Store::wasteful() const
+{
+	guint64 live = MAGIC_SIZE;
+	for (std::map <std::string, Entry>::const_iterator it = index.begin();
+	     it != index.end(); it++)
+		live += RECORD_HEADER + it->first.size() + it->second.length;
+	return fd >= 0 && compact_fd < 0 && log_size > MIN_COMPACT && log_size > live * 2;
+}
+
+bool Store::compactStart (std::string &error)
+{
+	std::string path = dir + "/news.log.new";
+	compact_fd = ::open (path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (compact_fd < 0) {
+		error = errno_msg ("couldn't open " + path);
+		return false;
+	}
+	compact_index = index;
+	compact_from = log_size;
+	compact_size = 0;
+	return true;
+}
+
+bool Store::compactRun (std::string &error)
+{
+	// only pread()s the log, which flush() just appends to meanwhile
+	std::string buffer (LOG_MAGIC), data;
+	guint64 offset = MAGIC_SIZE;
+	for (std::map <std::string, Entry>::iterator it = compact_index.begin();
+	     it != compact_index.end(); it++) {
+		const std::string &key = it->first;
+		Entry &entry = it->second;
+		data.resize (entry.length);
+		if (!read_all (fd, entry.offset, &data[0], entry.length)) {
+			error = errno_msg ("couldn't read the news log");
+			return false;
+		}
+		guint32 header[3] = { (guint32) key.size(), entry.length,
+			checksum (data.data(), data.size(), checksum (key.data(), key.size())) };
+		buffer.append ((const char *) header, RECORD_HEADER);
+		buffer += key;
+		buffer += data;
+		entry.offset = offset + RECORD_HEADER + key.size();
+		offset += RECORD_HEADER + key.size() + data.size();
+		if (buffer.size() >= MIN_COMPACT) {
+			if (!write_all (compact_fd, buffer.data(), buffer.size())) {
+				error = errno_msg ("couldn't write the new news log");
+				return false;
+			}
+			buffer.clear();
+		}
+	}
+	if (!write_all (compact_fd, buffer.data(), buffer.size()) || fdatasync (compact_fd) != 0) {
+		error = errno_msg ("couldn't write the new news log");
+		return false;
+	}
+	compact_size = offset;
+	return true;
+}
+
+bool Store::compactFinish (guint64 *reclaimed, std::string &error)
+{
+	// what was written since start() goes along as it is
+	std::string tail (log_size - compact_from, '\0');
+	if ((!tail.empty() && !read_all (fd, compact_from, &tail[0], tail.size())) ||
+	    !write_all (compact_fd, tail.data(), tail.size()) || fdatasync (compact_fd) != 0) {
+		error = errno_msg ("couldn't write the new news log");
+		compactAbort();
+		return false;
+	}
+	// without an index, the log is scanned whole on open: no index is
+	// better than one of the old log if we crash before writing it anew
+	std::string path = dir + "/news.log", idx = dir + "/news.idx";
+	g_unlink (idx.c_str());
+	if (g_rename ((path + ".new").c_str(), path.c_str())) {
+		error = errno_msg ("couldn't rename the new news log");
+		compactAbort();
+		return false;
+	}
+	guint64 old_size = log_size;
+	close (fd);
+	fd = compact_fd;
+	compact_fd = -1;
+	index.swap (compact_index);
+	compact_index.clear();
+	log_size = scan (compact_size);
+	lseek (fd, log_size, SEEK_SET);
+	*reclaimed = old_size - log_size;
+	return writeIndex (error);
+}
+
+void Store::compactAbort()
+{
+	if (compact_fd >= 0) {
+		close (compact_fd);
+		compact_fd = -1;
+		g_unlink ((dir + "/news.log.new").c_str());
+	}
+	compact_index.clear();
+}
@@ -0,0 +1,99 @@
+// store.h
+// on-disk cache of the news, so that feeds have something to show before
+// they are downloaded
+
+#ifndef STORE_H
+#define STORE_H
+
+#include "date.h"
+#include <glib.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// how long news no longer in their feed are kept
+struct Retention
+{
+	int max_days;     // of age; 0 for no limit
+	int max_items;    // of a feed, counting those still in it; 0 for no limit
+	int keep_unread;  // if set, unread news are never too old nor too many
+
+	// the defaults; a feed's own has -1 where it takes the global one
+	Retention (int days = 90, int items = 1000, int unread = 1)
+	: max_days (days), max_items (items), keep_unread (unread) {}
+	Retention over (const Retention &global) const;
+};
+
+// An append-only log of batches (one per feed and refresh), plus an index of
+// the latest batch of each feed. Batches are only ever added: a feed's older
+// batches just stop being indexed. The index is a cache; the log tail it
+// doesn't cover (e.g. after a crash) is read back on open. The batches no
+// longer indexed are dropped by compacting the log into a new one.
+class Store
+{
+public:
+	// batch encoding
+	struct Writer {
+		std::string data;
+		void putInt (gint64 value);
+		void putString (const char *str, size_t len);
+		void putString (const std::string &str) { putString (str.data(), str.size()); }
+		void putDate (const Date &date);
+	};
+	struct Reader {  // data must outlive it
+		Reader (const std::string &data);
+		bool getInt (gint64 *value);
+		bool getString (std::string *str);
+		bool getString (const char **str, size_t *len);  // no copy: into data
+		bool getDate (Date *date);
+		bool ok() const { return !failed; }
+	private:
+		const char *p, *end;
+		bool failed;
+	};
+
+	// of a record, to tell one cut short by a crash
+	static guint32 checksum (const char *data, size_t len, guint32 hash = 2166136261u);
+
+	explicit Store (const std::string &dir);
+	~Store();
+	bool open (std::string &error);
+
+	// latest batch of key; false if there is none
+	bool load (const std::string &key, std::string *batch);
+
+	// queued until flush(), which writes them all with one sync
+	void put (const std::string &key, const std::string &batch);
+	void remove (const std::string &key);
+	bool pending() const { return !queue.empty(); }
+	bool flush (std::string &error);
+	bool contains (const std::string &key) const { return index.count (key); }
+
+	// compaction: start() and finish() are called like the rest, while
+	// run() does the copying and may be called from another thread meanwhile
+	bool wasteful() const;
+	bool compactStart (std::string &error);
+	bool compactRun (std::string &error);
+	bool compactFinish (guint64 *reclaimed, std::string &error);
+	void compactAbort();
+
+private:
+	struct Entry {
+		guint64 offset;  // of the batch data in the log
+		guint32 length;
+	};
+	std::string dir;
+	int fd;
+	guint64 log_size;
+	std::map <std::string, Entry> index;
+	std::vector <std::pair <std::string, std::string> > queue;
+	int compact_fd;
+	guint64 compact_from, compact_size;
+	std::map <std::string, Entry> compact_index;
+
+	guint64 scan (guint64 from);
+	bool readIndex();
+	bool writeIndex (std::string &error);
+};
+
+#endif /*STORE_H*/
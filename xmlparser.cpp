@@ -28,19 +28,21 @@ struct XmlParser::Impl
 	GSList *handler_stack;
 	GMarkupParseContext *context;
 	std::string text, text_element_name;
+	int depth, max_depth;
+	size_t max_text;
 
 	Impl (XmlParser::Handler *handler)
-	: handler (handler)
+	: handler (handler), depth (0), max_depth (0), max_text (0)
 	{
 		handler_stack = g_slist_append (NULL, handler);
 		context = g_markup_parse_context_new (&parser,
 			G_MARKUP_TREAT_CDATA_AS_TEXT, this, NULL);
 	}
 
-	bool parse (const std::string &text, std::string &error_msg)
+	bool parse (const char *text, gssize len, std::string &error_msg)
 	{
 		GError *error = 0;
-		if (!g_markup_parse_context_parse (context, text.c_str(), -1, &error)) {
+		if (!g_markup_parse_context_parse (context, text, len, &error)) {
 			error_msg = error->message;
 			g_error_free (error);
 			return false;
@@ -61,21 +63,27 @@ struct XmlParser::Impl
 		if (!text.empty() && (text_element_name != element_name))
 			flushText (error_msg);
 		text_element_name = element_name;
-
-		std::string str (_text, text_len);
-		// glib does replace entities but gets stuck on self-referenciated entities
-		// e.g. glib converts "&amp;gt;" to "&gt;" -- stopping short of ">"
-		std::string::size_type i = 0;
-		while ((i = str.find ("&gt;", i)) != std::string::npos) {
-			str[i] = '>';
-			str.erase (i+1, 3);
-			i++;
+		if (max_text && text.size() + text_len > max_text) {
+			gchar *str = g_strdup_printf ("Text of <%s> is larger than %lu KB",
+				element_name, (unsigned long) max_text / 1024);
+			error_msg = str;
+			g_free (str);
+			return;
 		}
-		text += str;
+		text.append (_text, text_len);
 	}
 	void flushText (std::string &error_msg)
 	{
 		if (!text.empty()) {
+			// glib does replace entities but gets stuck on self-referenciated entities
+			// e.g. glib converts "&amp;gt;" to "&gt;" -- stopping short of ">"
+			// (done here since glib may split the text anywhere)
+			std::string::size_type i = 0;
+			while ((i = text.find ("&gt;", i)) != std::string::npos) {
+				text[i] = '>';
+				text.erase (i+1, 3);
+				i++;
+			}
 			top()->textElement (text_element_name.c_str(), text, error_msg);
 			text.clear();
 		}
@@ -102,6 +110,14 @@ static void parse_start_element (GMarkupParseContext *context,
 	std::string error_msg;
 	XmlParser::Impl *parser = (XmlParser::Impl *) data;
 	parser->flushText (error_msg);
+	if (parser->max_depth && ++parser->depth > parser->max_depth) {
+		gchar *str = g_strdup_printf ("Elements nested deeper than %d levels",
+			parser->max_depth);
+		error_msg = str;
+		g_free (str);
+		check_error (error_msg, error);
+		return;
+	}
 
 	XmlParser::Handler *handler = parser->top(), *child;
 	child = handler->startElement (element_name, attribute_names, attribute_values, error_msg);
@@ -119,6 +135,7 @@ static void parse_text (GMarkupParseContext *context,
 
 	const gchar *element_name = g_markup_parse_context_get_element (context);
 	parser->pushText (element_name, text, text_len, error_msg);
+	check_error (error_msg, error);
 }
 
 static void parse_end_element (GMarkupParseContext *context,
@@ -127,6 +144,7 @@ static void parse_end_element (GMarkupParseContext *context,
 	std::string error_msg;
 	XmlParser::Impl *parser = (XmlParser::Impl *) data;
 	parser->flushText (error_msg);
+	parser->depth--;
 
 	XmlParser::Handler *child = parser->pop();
 	XmlParser::Handler *handler = parser->top();
@@ -143,7 +161,13 @@ XmlParser::~XmlParser()
 { delete impl; }
 
 bool XmlParser::parse (const std::string &text, std::string &error_msg)
-{ return impl->parse (text, error_msg); }
+{ return impl->parse (text.c_str(), -1, error_msg); }
+
+bool XmlParser::parse (const char *text, size_t len, std::string &error_msg)
+{ return impl->parse (text, len, error_msg); }
+
+void XmlParser::setLimits (int max_depth, size_t max_text)
+{ impl->max_depth = max_depth; impl->max_text = max_text; }
 
 const char *XmlParser::get_value (const char *attribute_name,
 	const char **attribute_names, const char **attribute_values)
@@ -157,48 +181,74 @@ const char *XmlParser::get_value (const char *attribute_name,
 // utitlies:
 
 #include <curl/curl.h>
-static char curl_errorBuffer [CURL_ERROR_SIZE] = { 0 };
 
-bool download (const std::string &url, write_callback func, void *data)
+bool download (const std::string &url, write_callback func,
+               write_callback header_func, void *data, std::string &error_msg,
+               const char *accept)
 {
-	curl_errorBuffer[0] = '\0';
+	char errorBuffer [CURL_ERROR_SIZE] = { 0 };  // threads download concurrently
 	CURL *curl;
 	CURLcode result;
+	struct curl_slist *headers = NULL;
 	curl = curl_easy_init();
 	if (curl) {
-		std::string buffer;
-		curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, curl_errorBuffer);
+		curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, errorBuffer);
 		curl_easy_setopt (curl, CURLOPT_URL, url.c_str());
 		curl_easy_setopt (curl, CURLOPT_HEADER, 0);
 		curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1);
 		curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, func);
 		curl_easy_setopt (curl, CURLOPT_WRITEDATA, data);
+		if (header_func) {
+			curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, header_func);
+			curl_easy_setopt (curl, CURLOPT_HEADERDATA, data);
+		}
+		if (accept) {
+			std::string header = std::string ("Accept: ") + accept;
+			headers = curl_slist_append (headers, header.c_str());
+			curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
+		}
 		// set timeout to 60 secs and disable signals on timeout
 		curl_easy_setopt (curl, CURLOPT_TIMEOUT, 60);
 		curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1);
 		result = curl_easy_perform (curl);  // action
 		curl_easy_cleanup(curl);  
+		curl_slist_free_all (headers);
+		if (result != CURLE_OK && error_msg.empty())
+			error_msg = *errorBuffer ? errorBuffer : curl_easy_strerror (result);
 		return result == CURLE_OK;
 	}
+	if (error_msg.empty())
+		error_msg = "Couldn't initialize curl";
 	return false;
 }
 
-std::string download (const std::string &url, std::string &error_msg)
+bool download (const std::string &url, write_callback func, void *data)
+{
+	std::string error;
+	return download (url, func, NULL, data, error);
+}
+
+std::string download (const std::string &url, std::string &error_msg,
+                      size_t max_size)
 {
 	struct inner {
+		std::string buffer;
+		size_t max_size;
+
 		static size_t writer (char *data, size_t size, size_t nitems, void *user_data)
 		{
-			std::string *buffer = (std::string *) user_data;
+			inner *pThis = (inner *) user_data;
 			size_t len = size * nitems;
-			buffer->append (data, len);
+			if (pThis->max_size && pThis->buffer.size() + len > pThis->max_size)
+				return 0;  // abort transfer
+			pThis->buffer.append (data, len);
 			return len;
 		}
-	};
+	} data;
 
-	std::string buffer;
-	if (download (url, inner::writer, &buffer))
-		return buffer;
-	error_msg = curl_errorBuffer;
+	data.max_size = max_size;
+	if (download (url, inner::writer, NULL, &data, error_msg))
+		return data.buffer;
 	return "";
 }
 
@@ -10,6 +10,7 @@
 
 struct XmlParser {
 	struct Handler {
+		virtual ~Handler() {}  // children are deleted through it
 		virtual Handler *startElement (const char *name,
 			const char **attribute_names, const char **attribute_values,
 			std::string &error) = 0;
@@ -27,6 +28,10 @@ struct XmlParser {
 
 	// you may break xml text into various calls
 	bool parse (const std::string &text, std::string &error_msg);
+	bool parse (const char *text, size_t len, std::string &error_msg);
+
+	// parsing fails beyond these (0 for no limit)
+	void setLimits (int max_depth, size_t max_text);
 
 	// utilities:
 	static const char *get_value (const char *attribute_name,
@@ -39,8 +44,14 @@ struct XmlParser {
 // curl wrapper:
 typedef size_t (*write_callback) (char *buffer, size_t size, size_t nitems, void *data);
 bool download (const std::string &url, write_callback func, void *data);
-
-std::string download (const std::string &url, std::string &error_msg);  // convenience
+// header_func receives each header line; error_msg is left alone if already set;
+// accept is the value of the Accept header sent, if any
+bool download (const std::string &url, write_callback func,
+               write_callback header_func, void *data, std::string &error_msg,
+               const char *accept = NULL);
+
+std::string download (const std::string &url, std::string &error_msg,
+                      size_t max_size = 0);  // convenience
 
 #endif /*XML_PARSER_H*/
 